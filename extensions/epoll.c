@@ -32,6 +32,8 @@
 #include <sys/epoll.h>
 #include <libguile.h>
 
+#include "monotonic-time.h"
+
 #if SCM_MAJOR_VERSION == 2
 # include <fcntl.h>				  /* O_CLOEXEC */
 #endif
@@ -218,32 +220,6 @@ scm_primitive_epoll_wait (SCM epfd, SCM wakefd, SCM wokefd,
 }
 #undef FUNC_NAME
 
-static SCM sym_read_pipe, sym_write_pipe;
-
-/* Note: Guile 3.0.9 introduced an 'scm_pipe2' function, which is marked as
-   'SCM_INTERNAL'.  Use a different name here to avoid a collision.  */
-static SCM
-scm_fibers_pipe2 (SCM flags)
-#define FUNC_NAME "scm_fibers_pipe2"
-{
-  int c_flags, ret, fd[2];
-  SCM read_port, write_port;
-
-  if (scm_is_eq (flags, SCM_UNDEFINED))
-    c_flags = 0;
-  else
-    SCM_VALIDATE_INT_COPY (1, flags, c_flags);
-
-  do
-    ret = pipe2 (fd, c_flags);
-  while (ret == EINTR);
-
-  read_port = scm_fdes_to_port (fd[0], "r", sym_read_pipe);
-  write_port = scm_fdes_to_port (fd[1], "w", sym_write_pipe);
-
-  return scm_cons (read_port, write_port);
-}
-#undef FUNC_NAME
 
 
 
@@ -276,14 +252,15 @@ init_fibers_epoll (void)
   scm_c_define ("EPOLLET", scm_from_int (EPOLLET));
 #ifdef EPOLLONESHOT
   scm_c_define ("EPOLLONESHOT", scm_from_int (EPOLLONESHOT));
+#endif
+#ifdef EPOLLEXCLUSIVE
+  scm_c_define ("EPOLLEXCLUSIVE", scm_from_int (EPOLLEXCLUSIVE));
 #endif
   scm_c_define ("EPOLL_CTL_ADD", scm_from_int (EPOLL_CTL_ADD));
   scm_c_define ("EPOLL_CTL_MOD", scm_from_int (EPOLL_CTL_MOD));
   scm_c_define ("EPOLL_CTL_DEL", scm_from_int (EPOLL_CTL_DEL));
 
-  scm_c_define_gsubr ("pipe2", 0, 1, 0, scm_fibers_pipe2);
-  sym_read_pipe = scm_from_latin1_string ("read pipe");
-  sym_write_pipe = scm_from_latin1_string ("write pipe");
+  init_fibers_monotonic_time ();
 
 #if SCM_MAJOR_VERSION == 2
   /* Guile 2.2.7 lacks a definition for O_CLOEXEC.  */
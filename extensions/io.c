@@ -0,0 +1,719 @@
+/* Copyright (C) 2023 Free Software Foundation, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#include <fcntl.h>
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#include <libguile.h>
+
+#include "io.h"
+
+/* The maximum number of slices passed to one readv or writev call.
+   Any further slices are left for the next call, as if the call had
+   been partial.  */
+#if defined IOV_MAX && IOV_MAX < 64
+# define FIBERS_IOV_MAX IOV_MAX
+#else
+# define FIBERS_IOV_MAX 64
+#endif
+
+/* Return non-zero if FD has any of EVENTS pending, without blocking.
+   Errors and hangups count as ready, so that the caller goes on to
+   perform the I/O and sees the error there.  Unlike select, this
+   works for any file descriptor, not just those below FD_SETSIZE.  */
+static int
+fd_ready (const char *func_name, int fd, short events)
+{
+  struct pollfd pfd;
+  int rv;
+
+  pfd.fd = fd;
+  pfd.events = events;
+  pfd.revents = 0;
+
+  do
+    rv = poll (&pfd, 1, 0);
+  while (rv < 0 && errno == EINTR);
+
+  if (rv < 0)
+    scm_syserror (func_name);
+
+  return rv > 0;
+}
+
+static SCM
+scm_primitive_fd_readable_p (SCM fd)
+#define FUNC_NAME "primitive-fd-readable?"
+{
+  return scm_from_bool (fd_ready (FUNC_NAME, scm_to_int (fd), POLLIN));
+}
+#undef FUNC_NAME
+
+static SCM
+scm_primitive_fd_writable_p (SCM fd)
+#define FUNC_NAME "primitive-fd-writable?"
+{
+  return scm_from_bool (fd_ready (FUNC_NAME, scm_to_int (fd), POLLOUT));
+}
+#undef FUNC_NAME
+
+/* Return a pointer to the COUNT bytes of the bytevector BV starting
+   at START, after checking that they are all within BV.  */
+static char *
+bytevector_range (const char *func_name, SCM bv, SCM start, SCM count,
+                  size_t *c_count)
+#define FUNC_NAME func_name
+{
+  size_t c_start, len;
+
+  SCM_VALIDATE_BYTEVECTOR (2, bv);
+  len = SCM_BYTEVECTOR_LENGTH (bv);
+  c_start = scm_to_size_t (start);
+  *c_count = scm_to_size_t (count);
+  if (c_start > len)
+    scm_out_of_range (func_name, start);
+  if (*c_count > len - c_start)
+    scm_out_of_range (func_name, count);
+
+  return (char *) SCM_BYTEVECTOR_CONTENTS (bv) + c_start;
+}
+#undef FUNC_NAME
+
+/* Turn the result RV of a nonblocking read or write into a Scheme
+   value: the number of bytes transferred, or #f if the call would have
+   blocked.  */
+static SCM
+transfer_result (const char *func_name, ssize_t rv)
+{
+  if (rv >= 0)
+    return scm_from_ssize_t (rv);
+  if (errno == EAGAIN || errno == EWOULDBLOCK)
+    return SCM_BOOL_F;
+  scm_syserror (func_name);
+}
+
+static SCM
+scm_primitive_fd_read (SCM fd, SCM bv, SCM start, SCM count)
+#define FUNC_NAME "primitive-fd-read"
+{
+  size_t c_count;
+  char *buf = bytevector_range (FUNC_NAME, bv, start, count, &c_count);
+  int c_fd = scm_to_int (fd);
+  ssize_t rv;
+
+  do
+    rv = read (c_fd, buf, c_count);
+  while (rv < 0 && errno == EINTR);
+
+  return transfer_result (FUNC_NAME, rv);
+}
+#undef FUNC_NAME
+
+static SCM
+scm_primitive_fd_write (SCM fd, SCM bv, SCM start, SCM count)
+#define FUNC_NAME "primitive-fd-write"
+{
+  size_t c_count;
+  char *buf = bytevector_range (FUNC_NAME, bv, start, count, &c_count);
+  int c_fd = scm_to_int (fd);
+  ssize_t rv;
+
+  do
+    rv = write (c_fd, buf, c_count);
+  while (rv < 0 && errno == EINTR);
+
+  return transfer_result (FUNC_NAME, rv);
+}
+#undef FUNC_NAME
+
+static SCM
+scm_primitive_fd_recv (SCM fd, SCM bv, SCM start, SCM count, SCM flags)
+#define FUNC_NAME "primitive-fd-recv"
+{
+  size_t c_count;
+  char *buf = bytevector_range (FUNC_NAME, bv, start, count, &c_count);
+  int c_fd = scm_to_int (fd);
+  int c_flags = scm_to_int (flags);
+  ssize_t rv;
+
+  do
+    rv = recv (c_fd, buf, c_count, c_flags | MSG_DONTWAIT);
+  while (rv < 0 && errno == EINTR);
+
+  return transfer_result (FUNC_NAME, rv);
+}
+#undef FUNC_NAME
+
+/* Like `primitive-fd-write', but for sockets.  Writing to a closed
+   connection raises EPIPE instead of raising SIGPIPE, where
+   possible.  */
+static SCM
+scm_primitive_fd_send (SCM fd, SCM bv, SCM start, SCM count, SCM flags)
+#define FUNC_NAME "primitive-fd-send"
+{
+  size_t c_count;
+  char *buf = bytevector_range (FUNC_NAME, bv, start, count, &c_count);
+  int c_fd = scm_to_int (fd);
+  int c_flags = scm_to_int (flags);
+  ssize_t rv;
+
+#ifdef MSG_NOSIGNAL
+  c_flags |= MSG_NOSIGNAL;
+#endif
+
+  do
+    rv = send (c_fd, buf, c_count, c_flags | MSG_DONTWAIT);
+  while (rv < 0 && errno == EINTR);
+
+  return transfer_result (FUNC_NAME, rv);
+}
+#undef FUNC_NAME
+
+/* Fill IOV with up to FIBERS_IOV_MAX slices from the list SLICES.  A
+   slice is either a bytevector or a list of a bytevector, a start index
+   and a count.  Return the number of entries filled.  */
+static int
+slices_to_iovec (const char *func_name, SCM slices, struct iovec *iov)
+{
+  int n;
+
+  for (n = 0; n < FIBERS_IOV_MAX && scm_is_pair (slices);
+       n++, slices = scm_cdr (slices))
+    {
+      SCM slice = scm_car (slices);
+      size_t count;
+
+      if (scm_is_bytevector (slice))
+        iov[n].iov_base = bytevector_range (func_name, slice, scm_from_int (0),
+                                            scm_from_size_t
+                                            (scm_c_bytevector_length (slice)),
+                                            &count);
+      else if (scm_ilength (slice) == 3)
+        iov[n].iov_base = bytevector_range (func_name, scm_car (slice),
+                                            scm_cadr (slice),
+                                            scm_caddr (slice), &count);
+      else
+        scm_wrong_type_arg (func_name, 2, slice);
+      iov[n].iov_len = count;
+    }
+
+  return n;
+}
+
+static SCM
+scm_primitive_fd_readv (SCM fd, SCM slices)
+#define FUNC_NAME "primitive-fd-readv"
+{
+  struct iovec iov[FIBERS_IOV_MAX];
+  int c_fd = scm_to_int (fd);
+  int iovcnt = slices_to_iovec (FUNC_NAME, slices, iov);
+  ssize_t rv;
+
+  do
+    rv = readv (c_fd, iov, iovcnt);
+  while (rv < 0 && errno == EINTR);
+
+  return transfer_result (FUNC_NAME, rv);
+}
+#undef FUNC_NAME
+
+static SCM
+scm_primitive_fd_writev (SCM fd, SCM slices)
+#define FUNC_NAME "primitive-fd-writev"
+{
+  struct iovec iov[FIBERS_IOV_MAX];
+  int c_fd = scm_to_int (fd);
+  int iovcnt = slices_to_iovec (FUNC_NAME, slices, iov);
+  ssize_t rv;
+
+  do
+    rv = writev (c_fd, iov, iovcnt);
+  while (rv < 0 && errno == EINTR);
+
+  return transfer_result (FUNC_NAME, rv);
+}
+#undef FUNC_NAME
+
+/* Send up to COUNT bytes from the file IN_FD to the socket OUT_FD,
+   starting at OFFSET, or at the current position of IN_FD if OFFSET is
+   #f.  */
+static SCM
+scm_primitive_fd_sendfile (SCM out_fd, SCM in_fd, SCM offset, SCM count)
+#define FUNC_NAME "primitive-fd-sendfile"
+{
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+  int c_out_fd = scm_to_int (out_fd);
+  int c_in_fd = scm_to_int (in_fd);
+  size_t c_count = scm_to_size_t (count);
+  off_t c_offset = 0;
+  off_t *offset_ptr = NULL;
+  ssize_t rv;
+
+  if (scm_is_true (offset))
+    {
+      c_offset = scm_to_int64 (offset);
+      offset_ptr = &c_offset;
+    }
+
+  do
+    rv = sendfile (c_out_fd, c_in_fd, offset_ptr, c_count);
+  while (rv < 0 && errno == EINTR);
+
+  return transfer_result (FUNC_NAME, rv);
+#else
+  errno = ENOSYS;
+  scm_syserror (FUNC_NAME);
+#endif
+}
+#undef FUNC_NAME
+
+/* Move up to COUNT bytes from IN_FD to OUT_FD without copying them
+   through user space.  One of the two must be a pipe.  */
+static SCM
+scm_primitive_fd_splice (SCM in_fd, SCM out_fd, SCM count)
+#define FUNC_NAME "primitive-fd-splice"
+{
+#ifdef HAVE_SPLICE
+  int c_in_fd = scm_to_int (in_fd);
+  int c_out_fd = scm_to_int (out_fd);
+  size_t c_count = scm_to_size_t (count);
+  ssize_t rv;
+
+  do
+    rv = splice (c_in_fd, NULL, c_out_fd, NULL, c_count,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  while (rv < 0 && errno == EINTR);
+
+  return transfer_result (FUNC_NAME, rv);
+#else
+  errno = ENOSYS;
+  scm_syserror (FUNC_NAME);
+#endif
+}
+#undef FUNC_NAME
+
+/* The maximum number of datagrams passed to one recvmmsg or sendmmsg
+   call.  */
+#define FIBERS_MMSG_MAX 64
+
+/* Check the arguments of the datagram primitives: datagrams START to
+   START+COUNT-1 live in the bytevector ARENA, SLOT_SIZE bytes apart,
+   and their lengths are stored as native uint32 values in the
+   bytevector LENGTHS.  */
+static void
+check_datagram_arena (const char *func_name, SCM arena, SCM lengths,
+                      size_t slot_size, size_t start, size_t count)
+#define FUNC_NAME func_name
+{
+  SCM_VALIDATE_BYTEVECTOR (2, arena);
+  SCM_VALIDATE_BYTEVECTOR (4, lengths);
+  if (slot_size == 0
+      || (start + count) > SCM_BYTEVECTOR_LENGTH (arena) / slot_size
+      || (start + count) > SCM_BYTEVECTOR_LENGTH (lengths) / sizeof (uint32_t))
+    scm_out_of_range (func_name, scm_from_size_t (start + count));
+}
+#undef FUNC_NAME
+
+static char *
+datagram_slot (SCM arena, size_t slot_size, size_t i)
+{
+  return (char *) SCM_BYTEVECTOR_CONTENTS (arena) + i * slot_size;
+}
+
+static void
+set_datagram_length (SCM lengths, size_t i, size_t len)
+{
+  uint32_t c_len = len;
+  memcpy ((char *) SCM_BYTEVECTOR_CONTENTS (lengths) + i * sizeof (uint32_t),
+          &c_len, sizeof (c_len));
+}
+
+static size_t
+datagram_length (SCM lengths, size_t i)
+{
+  uint32_t c_len;
+  memcpy (&c_len,
+          (char *) SCM_BYTEVECTOR_CONTENTS (lengths) + i * sizeof (uint32_t),
+          sizeof (c_len));
+  return c_len;
+}
+
+/* Receive up to MAX datagrams from the socket FD into the slots of
+   ARENA, recording their lengths in LENGTHS.  Return the number of
+   datagrams received, or #f if none was available.  Datagrams longer
+   than SLOT_SIZE are truncated; byte I of the bytevector TRUNCATED is
+   set to 1 if datagram I was, and to 0 otherwise.  */
+static SCM
+scm_primitive_fd_recvmmsg (SCM fd, SCM arena, SCM slot_size, SCM lengths,
+                           SCM truncated, SCM max)
+#define FUNC_NAME "primitive-fd-recvmmsg"
+{
+  int c_fd = scm_to_int (fd);
+  size_t c_slot_size = scm_to_size_t (slot_size);
+  size_t c_max = scm_to_size_t (max);
+  char *c_truncated;
+  size_t i;
+
+  check_datagram_arena (FUNC_NAME, arena, lengths, c_slot_size, 0, c_max);
+  SCM_VALIDATE_BYTEVECTOR (5, truncated);
+  if (c_max > SCM_BYTEVECTOR_LENGTH (truncated))
+    scm_out_of_range (FUNC_NAME, scm_from_size_t (c_max));
+  c_truncated = (char *) SCM_BYTEVECTOR_CONTENTS (truncated);
+  if (c_max > FIBERS_MMSG_MAX)
+    c_max = FIBERS_MMSG_MAX;
+
+#ifdef HAVE_RECVMMSG
+  {
+    struct mmsghdr msgs[FIBERS_MMSG_MAX];
+    struct iovec iov[FIBERS_MMSG_MAX];
+    int rv;
+
+    memset (msgs, 0, c_max * sizeof (msgs[0]));
+    for (i = 0; i < c_max; i++)
+      {
+        iov[i].iov_base = datagram_slot (arena, c_slot_size, i);
+        iov[i].iov_len = c_slot_size;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+    do
+      rv = recvmmsg (c_fd, msgs, c_max, MSG_DONTWAIT, NULL);
+    while (rv < 0 && errno == EINTR);
+
+    if (rv < 0)
+      return transfer_result (FUNC_NAME, rv);
+
+    for (i = 0; i < (size_t) rv; i++)
+      {
+        set_datagram_length (lengths, i, msgs[i].msg_len);
+        c_truncated[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+      }
+
+    return scm_from_int (rv);
+  }
+#else
+  /* Fall back to one recvmsg per datagram, until the socket runs dry.
+     Unlike recv, recvmsg reports truncation in msg_flags.  */
+  for (i = 0; i < c_max; i++)
+    {
+      struct msghdr msg;
+      struct iovec iov;
+      ssize_t rv;
+
+      iov.iov_base = datagram_slot (arena, c_slot_size, i);
+      iov.iov_len = c_slot_size;
+      memset (&msg, 0, sizeof msg);
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+
+      do
+        rv = recvmsg (c_fd, &msg, MSG_DONTWAIT);
+      while (rv < 0 && errno == EINTR);
+
+      if (rv < 0)
+        {
+          if (i > 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+          return transfer_result (FUNC_NAME, rv);
+        }
+      set_datagram_length (lengths, i, rv);
+      c_truncated[i] = (msg.msg_flags & MSG_TRUNC) != 0;
+    }
+
+  return scm_from_size_t (i);
+#endif
+}
+#undef FUNC_NAME
+
+/* Send datagrams START to START+COUNT-1 of ARENA, whose lengths are
+   recorded in LENGTHS, on the connected socket FD.  Return the number
+   of datagrams sent, or #f if none could be sent without blocking.  */
+static SCM
+scm_primitive_fd_sendmmsg (SCM fd, SCM arena, SCM slot_size, SCM lengths,
+                           SCM start, SCM count)
+#define FUNC_NAME "primitive-fd-sendmmsg"
+{
+  int c_fd = scm_to_int (fd);
+  size_t c_slot_size = scm_to_size_t (slot_size);
+  size_t c_start = scm_to_size_t (start);
+  size_t c_count = scm_to_size_t (count);
+  int flags = MSG_DONTWAIT;
+  size_t i;
+
+  check_datagram_arena (FUNC_NAME, arena, lengths, c_slot_size,
+                        c_start, c_count);
+  if (c_count > FIBERS_MMSG_MAX)
+    c_count = FIBERS_MMSG_MAX;
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif
+
+  for (i = 0; i < c_count; i++)
+    if (datagram_length (lengths, c_start + i) > c_slot_size)
+      scm_out_of_range (FUNC_NAME, scm_from_size_t (c_start + i));
+
+#ifdef HAVE_SENDMMSG
+  {
+    struct mmsghdr msgs[FIBERS_MMSG_MAX];
+    struct iovec iov[FIBERS_MMSG_MAX];
+    int rv;
+
+    memset (msgs, 0, c_count * sizeof (msgs[0]));
+    for (i = 0; i < c_count; i++)
+      {
+        iov[i].iov_base = datagram_slot (arena, c_slot_size, c_start + i);
+        iov[i].iov_len = datagram_length (lengths, c_start + i);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+    do
+      rv = sendmmsg (c_fd, msgs, c_count, flags);
+    while (rv < 0 && errno == EINTR);
+
+    return transfer_result (FUNC_NAME, rv);
+  }
+#else
+  for (i = 0; i < c_count; i++)
+    {
+      ssize_t rv;
+
+      do
+        rv = send (c_fd, datagram_slot (arena, c_slot_size, c_start + i),
+                   datagram_length (lengths, c_start + i), flags);
+      while (rv < 0 && errno == EINTR);
+
+      if (rv < 0)
+        {
+          if (i > 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+          return transfer_result (FUNC_NAME, rv);
+        }
+    }
+
+  return scm_from_size_t (i);
+#endif
+}
+#undef FUNC_NAME
+
+/* Return a file descriptor that refers to the child process PID and
+   becomes readable when it exits, or #f if the system has no
+   pidfd_open.  */
+static SCM
+scm_primitive_pidfd_open (SCM pid)
+#define FUNC_NAME "primitive-pidfd-open"
+{
+#ifdef SYS_pidfd_open
+  int fd = syscall (SYS_pidfd_open, scm_to_int (pid), 0);
+
+  if (fd < 0)
+    {
+      if (errno == ENOSYS)
+        return SCM_BOOL_F;
+      scm_syserror (FUNC_NAME);
+    }
+  return scm_from_int (fd);
+#else
+  return SCM_BOOL_F;
+#endif
+}
+#undef FUNC_NAME
+
+/* For each signal, the write end of the pipe that forward_signal
+   writes to when the signal arrives, or -1.  */
+static int signal_pipe_write_fds[NSIG];
+
+/* Record the arrival of SIG by writing a byte to its pipe.  This only
+   uses async-signal-safe calls, and works on whichever thread the
+   signal is delivered to.  If the pipe is full, the signal is pending
+   anyway, so the failed write loses nothing.  */
+static void
+forward_signal (int sig)
+{
+  int saved_errno = errno;
+  unsigned char byte = sig;
+  int fd = signal_pipe_write_fds[sig];
+
+  if (fd >= 0)
+    {
+      ssize_t rv = write (fd, &byte, 1);
+      (void) rv;
+    }
+  errno = saved_errno;
+}
+
+static int
+make_nonblocking_cloexec (int fd)
+{
+  int flags = fcntl (fd, F_GETFL);
+
+  if (flags < 0 || fcntl (fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return -1;
+  return fcntl (fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* Install a handler for SIGNUM that writes a byte to a new nonblocking
+   pipe each time the signal arrives, and return the read end of the
+   pipe.  The caller must ensure that this is called at most once per
+   signal, and not concurrently.  */
+static SCM
+scm_primitive_signal_fd (SCM signum)
+#define FUNC_NAME "primitive-signal-fd"
+{
+  int sig = scm_to_int (signum);
+  int fds[2];
+  struct sigaction sa;
+
+  if (sig <= 0 || sig >= NSIG)
+    scm_out_of_range (FUNC_NAME, signum);
+  if (signal_pipe_write_fds[sig] >= 0)
+    scm_misc_error (FUNC_NAME, "signal ~S is already being forwarded",
+                    scm_list_1 (signum));
+
+  if (pipe (fds) < 0)
+    scm_syserror (FUNC_NAME);
+  if (make_nonblocking_cloexec (fds[0]) < 0
+      || make_nonblocking_cloexec (fds[1]) < 0)
+    goto fail;
+
+  signal_pipe_write_fds[sig] = fds[1];
+  memset (&sa, 0, sizeof sa);
+  sa.sa_handler = forward_signal;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction (sig, &sa, NULL) < 0)
+    {
+      signal_pipe_write_fds[sig] = -1;
+      goto fail;
+    }
+
+  return scm_from_int (fds[0]);
+
+ fail:
+  {
+    int saved_errno = errno;
+    close (fds[0]);
+    close (fds[1]);
+    errno = saved_errno;
+    scm_syserror (FUNC_NAME);
+  }
+}
+#undef FUNC_NAME
+
+static SCM sym_read_pipe, sym_write_pipe;
+
+/* Note: Guile 3.0.9 introduced an 'scm_pipe2' function, which is marked as
+   'SCM_INTERNAL'.  Use a different name here to avoid a collision.  */
+static SCM
+scm_fibers_pipe2 (SCM flags)
+#define FUNC_NAME "scm_fibers_pipe2"
+{
+#ifdef HAVE_PIPE2
+  int c_flags, ret, fd[2];
+  SCM read_port, write_port;
+
+  if (scm_is_eq (flags, SCM_UNDEFINED))
+    c_flags = 0;
+  else
+    SCM_VALIDATE_INT_COPY (1, flags, c_flags);
+
+  do
+    ret = pipe2 (fd, c_flags);
+  while (ret < 0 && errno == EINTR);
+
+  if (ret < 0)
+    scm_syserror (FUNC_NAME);
+
+  read_port = scm_fdes_to_port (fd[0], "r", sym_read_pipe);
+  write_port = scm_fdes_to_port (fd[1], "w", sym_write_pipe);
+
+  return scm_cons (read_port, write_port);
+#else
+  errno = ENOSYS;
+  scm_syserror (FUNC_NAME);
+#endif
+}
+#undef FUNC_NAME
+
+/* Low-level helpers for (fibers io-primitives).  They are linked into the
+   extension of each events implementation, but initialized separately.  */
+void
+init_fibers_io (void)
+{
+  int sig;
+
+  for (sig = 0; sig < NSIG; sig++)
+    signal_pipe_write_fds[sig] = -1;
+
+  scm_c_define_gsubr ("primitive-fd-readable?", 1, 0, 0,
+                      scm_primitive_fd_readable_p);
+  scm_c_define_gsubr ("primitive-fd-writable?", 1, 0, 0,
+                      scm_primitive_fd_writable_p);
+  scm_c_define_gsubr ("primitive-fd-read", 4, 0, 0,
+                      scm_primitive_fd_read);
+  scm_c_define_gsubr ("primitive-fd-write", 4, 0, 0,
+                      scm_primitive_fd_write);
+  scm_c_define_gsubr ("primitive-fd-recv", 5, 0, 0,
+                      scm_primitive_fd_recv);
+  scm_c_define_gsubr ("primitive-fd-send", 5, 0, 0,
+                      scm_primitive_fd_send);
+  scm_c_define_gsubr ("primitive-fd-readv", 2, 0, 0,
+                      scm_primitive_fd_readv);
+  scm_c_define_gsubr ("primitive-fd-writev", 2, 0, 0,
+                      scm_primitive_fd_writev);
+  scm_c_define_gsubr ("primitive-fd-sendfile", 4, 0, 0,
+                      scm_primitive_fd_sendfile);
+  scm_c_define_gsubr ("primitive-fd-splice", 3, 0, 0,
+                      scm_primitive_fd_splice);
+  scm_c_define_gsubr ("primitive-fd-recvmmsg", 6, 0, 0,
+                      scm_primitive_fd_recvmmsg);
+  scm_c_define_gsubr ("primitive-fd-sendmmsg", 6, 0, 0,
+                      scm_primitive_fd_sendmmsg);
+  scm_c_define_gsubr ("primitive-pidfd-open", 1, 0, 0,
+                      scm_primitive_pidfd_open);
+  scm_c_define_gsubr ("primitive-signal-fd", 1, 0, 0,
+                      scm_primitive_signal_fd);
+
+  scm_c_define_gsubr ("pipe2", 0, 1, 0, scm_fibers_pipe2);
+  sym_read_pipe = scm_from_latin1_string ("read pipe");
+  sym_write_pipe = scm_from_latin1_string ("write pipe");
+}
+
+/*
+  Local Variables:
+  c-file-style: "gnu"
+  End:
+*/
@@ -28,6 +28,8 @@
 #include <event2/event.h>
 #include <libguile.h>
 
+#include "monotonic-time.h"
+
 #if SCM_MAJOR_VERSION == 2
 # include <fcntl.h>				  /* O_CLOEXEC */
 #endif
@@ -333,6 +335,10 @@ init_fibers_libevt (void)
   scm_c_define ("EVENTS_IMPL_READ", scm_from_int (EV_READ | EV_CLOSED));
   scm_c_define ("EVENTS_IMPL_WRITE", scm_from_int (EV_WRITE));
   scm_c_define ("EVENTS_IMPL_CLOSED_OR_ERROR", scm_from_int (EV_READ | EV_WRITE));
+  /* libevent has no exclusive wakeups.  */
+  scm_c_define ("EVENTS_IMPL_EXCLUSIVE", scm_from_int (0));
+
+  init_fibers_monotonic_time ();
 
 #if SCM_MAJOR_VERSION == 2
   /* Guile 2.2.7 lacks a definition for O_CLOEXEC.  */
@@ -0,0 +1,89 @@
+/* Copyright (C) 2023 Free Software Foundation, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <time.h>
+#include <libguile.h>
+
+#include "monotonic-time.h"
+
+/* The clock used by schedulers for timers and poll timeouts.  Unlike
+   `get-internal-real-time', which follows the wall clock, this clock
+   never jumps when the system time is changed.  */
+static clockid_t clock_id;
+
+/* Nanoseconds per internal time unit.  */
+static int64_t nsec_per_time_unit;
+
+/* Added to the clock so that its values start out close to those of
+   `get-internal-real-time', so that expiries computed from either
+   clock can be mixed as long as the wall clock does not jump.  */
+static int64_t time_offset;
+
+static int64_t
+read_clock (void)
+{
+  struct timespec ts;
+
+  clock_gettime (clock_id, &ts);
+
+  return (int64_t) ts.tv_sec * scm_c_time_units_per_second
+    + ts.tv_nsec / nsec_per_time_unit;
+}
+
+/* Return the current time of the scheduler clock, in internal time
+   units.  */
+static SCM
+scm_primitive_monotonic_time (void)
+#define FUNC_NAME "primitive-monotonic-time"
+{
+  return scm_from_int64 (read_clock () + time_offset);
+}
+#undef FUNC_NAME
+
+void
+init_fibers_monotonic_time (void)
+{
+  struct timespec ts;
+
+#if defined FIBERS_USE_COARSE_CLOCK && defined CLOCK_MONOTONIC_COARSE
+  clock_id = CLOCK_MONOTONIC_COARSE;
+#elif defined CLOCK_MONOTONIC
+  clock_id = CLOCK_MONOTONIC;
+#else
+  clock_id = CLOCK_REALTIME;
+#endif
+  if (clock_gettime (clock_id, &ts) != 0)
+    clock_id = CLOCK_REALTIME;
+
+  nsec_per_time_unit = 1000000000 / scm_c_time_units_per_second;
+  time_offset = scm_c_get_internal_real_time () - read_clock ();
+
+  scm_c_define_gsubr ("primitive-monotonic-time", 0, 0, 0,
+                      scm_primitive_monotonic_time);
+}
+
+/*
+  Local Variables:
+  c-file-style: "gnu"
+  End:
+*/
@@ -23,14 +23,17 @@
   #:use-module ((ice-9 ports internal)
                 #:select (port-read-wait-fd port-write-wait-fd))
   #:use-module (ice-9 suspendable-ports)
+  #:use-module (ice-9 fdes-finalizers)
   #:use-module (fibers scheduler)
   #:use-module (fibers repl)
   #:use-module (fibers timers)
   #:use-module (fibers interrupts)
   #:use-module (fibers affinity)
   #:use-module (fibers posix-clocks)
-  #:export (run-fibers spawn-fiber)
-  #:re-export (sleep dynamic-wind*))
+  #:export (run-fibers spawn-fiber
+            port-read-deadline set-port-read-deadline!
+            port-write-deadline set-port-write-deadline!)
+  #:re-export (sleep dynamic-wind* current-task-deadline))
 
 ;; Guile 2 and 3 compatibility. Some bit vector related procedures were
 ;; deprecated in Guile 3.0.3 and new ones were defined.
@@ -53,14 +56,157 @@
         (bitvector-set! v i #t))))
 ;; End of Guile 2 and 3 compatibility.
 
+;; Port deadlines are kept in a vector indexed by the fd that fibers
+;; wait on for the port, so that looking them up on every wait takes no
+;; lock.  Each slot is an atomic box of #f, or the address of the port
+;; that last set a deadline on that fd followed by its read and write
+;; deadlines.  The slot is cleared when the fd is closed, which also
+;; happens when a port that was never closed is collected, so the
+;; address can't be reused by another port while the slot refers to it.
+;; The vector only grows; growing copies the boxes themselves, so that
+;; updates to the old vector aren't lost.
+(define port-deadline-slots (make-atomic-box (vector)))
+
+(define (port-deadline-slot fd)
+  (let ((slots (atomic-box-ref port-deadline-slots)))
+    (and (< fd (vector-length slots))
+         (vector-ref slots fd))))
+
+(define (ensure-port-deadline-slot! fd)
+  (or (port-deadline-slot fd)
+      (let* ((slots (atomic-box-ref port-deadline-slots))
+             (n (vector-length slots))
+             (slots* (make-vector (max (1+ fd) (* 2 n)) #f)))
+        (vector-move-left! slots 0 n slots* 0)
+        (let lp ((i n))
+          (when (< i (vector-length slots*))
+            (vector-set! slots* i (make-atomic-box #f))
+            (lp (1+ i))))
+        (atomic-box-compare-and-swap! port-deadline-slots slots slots*)
+        (ensure-port-deadline-slot! fd))))
+
+(define (port-deadlines port fd)
+  "Return the read and write deadlines of @var{port}, which waits on
+@var{fd}, as a pair, or @code{#f} if it has none."
+  (let ((slot (port-deadline-slot fd)))
+    (match (and slot (atomic-box-ref slot))
+      ((owner . deadlines)
+       (and (eqv? owner (object-address port)) deadlines))
+      (#f #f))))
+
+(define (port-read-deadline port)
+  "Return the time after which fibers stop waiting for @var{port} to
+become readable, or @code{#f} if there is none."
+  (match (port-deadlines port (port-read-wait-fd port))
+    (#f #f)
+    ((read . write) read)))
+
+(define (port-write-deadline port)
+  "Return the time after which fibers stop waiting for @var{port} to
+become writable, or @code{#f} if there is none."
+  (match (port-deadlines port (port-write-wait-fd port))
+    (#f #f)
+    ((read . write) write)))
+
+(define (update-port-deadlines! port fd f)
+  (let ((slot (ensure-port-deadline-slot! fd))
+        (owner (object-address port)))
+    (let retry ((old (atomic-box-ref slot)))
+      (let* ((owned? (and old (eqv? (car old) owner)))
+             (new (cons owner (f (if owned? (cdr old) '(#f . #f)))))
+             (prev (atomic-box-compare-and-swap! slot old new)))
+        (cond
+         ((not (eq? prev old))
+          (retry prev))
+         ((not owned?)
+          ;; PORT keeps the slot until FD is closed, even if its
+          ;; deadlines are cleared, so that this finalizer is only added
+          ;; once.
+          (add-fdes-finalizer! fd (lambda (fd)
+                                    (atomic-box-set! slot #f)))))))))
+
+(define (check-deadline deadline)
+  ;; Timers need an exact number of internal time units; round a
+  ;; fractional deadline up rather than waking early.
+  (cond
+   ((or (not deadline) (exact-integer? deadline)) deadline)
+   ((real? deadline) (inexact->exact (ceiling deadline)))
+   (else (error "expected a deadline in internal time units" deadline))))
+
+(define (set-port-read-deadline! port deadline)
+  "Set the read deadline of @var{port} to @var{deadline}, in internal
+time units as returned by @code{scheduler-now}, or clear it if
+@var{deadline} is @code{#f}.  A deadline that isn't an integer is
+rounded up.  A fiber that would have to wait for
+@var{port} to become readable after the deadline raises a
+@code{port-timeout} exception instead."
+  (update-port-deadlines! port (port-read-wait-fd port)
+                          (match-lambda
+                            ((read . write)
+                             (cons (check-deadline deadline) write)))))
+
+(define (set-port-write-deadline! port deadline)
+  "Like @code{set-port-read-deadline!}, but for waiting until
+@var{port} becomes writable."
+  (update-port-deadlines! port (port-write-wait-fd port)
+                          (match-lambda
+                            ((read . write)
+                             (cons read (check-deadline deadline))))))
+
+(define (port-timeout port)
+  (scm-error 'port-timeout #f "Deadline passed while waiting on ~S"
+             (list port) (list port)))
+
+(define (wait-with-timeout port fd io-deadline schedule-when-ready)
+  "Suspend until @var{schedule-when-ready} resumes the current fiber or
+@var{io-deadline} passes, whichever comes first, raising an exception
+in the latter case."
+  (unless (< (scheduler-now) io-deadline)
+    (port-timeout port))
+  (when (suspend-current-task
+         (lambda (sched k)
+           ;; Whichever of the two wakeups comes first resumes K and
+           ;; cancels the other one, so that neither the timer nor the
+           ;; fd registration outlives the wait.
+           (let ((resumed? (make-atomic-box #f))
+                 (timer #f))
+             (define (first?)
+               (not (atomic-box-compare-and-swap! resumed? #f #t)))
+             (define (ready)
+               (when (first?)
+                 (unschedule-task-at-time sched timer)
+                 (k #f)))
+             (define (timeout)
+               (when (first?)
+                 (unschedule-task-when-fd-active sched fd ready)
+                 (k #t)))
+             (schedule-when-ready sched fd ready)
+             (set! timer (schedule-task-at-time sched io-deadline timeout)))))
+    (port-timeout port)))
+
 (define (wait-for-readable port)
-  (suspend-current-task
-   (lambda (sched k)
-     (schedule-task-when-fd-readable sched (port-read-wait-fd port) k))))
+  (let ((deadline (current-task-deadline))
+        (fd (port-read-wait-fd port)))
+    (define (schedule-when-readable sched fd k)
+      (schedule-task-when-fd-readable sched fd k deadline))
+    (match (port-read-deadline port)
+      (#f (suspend-current-task
+           (lambda (sched k)
+             (schedule-when-readable sched fd k))))
+      (io-deadline
+       (wait-with-timeout port fd io-deadline schedule-when-readable)))))
+
 (define (wait-for-writable port)
-  (suspend-current-task
-   (lambda (sched k)
-     (schedule-task-when-fd-writable sched (port-write-wait-fd port) k))))
+  (let ((deadline (current-task-deadline))
+        (fd (port-write-wait-fd port)))
+    (define (schedule-when-writable sched fd k)
+      (schedule-task-when-fd-writable sched fd k deadline))
+    (match (port-write-deadline port)
+      (#f (suspend-current-task
+           (lambda (sched k)
+             (schedule-when-writable sched fd k))))
+      (io-deadline
+       (wait-with-timeout port fd io-deadline schedule-when-writable)))))
 
 (define-syntax-rule (with-affinity affinity exp ...)
   (let ((saved #f))
@@ -124,7 +270,8 @@
                      (parallelism (current-processor-count))
                      (cpus (getaffinity* 0))
                      (install-suspendable-ports? #t)
-                     (drain? #f))
+                     (drain? #f)
+                     (deadline-ordered? #f))
   (when install-suspendable-ports? (install-suspendable-ports!))
   (cond
    (scheduler
@@ -132,7 +279,8 @@
       (when init (spawn-fiber init scheduler))
       (%run-fibers scheduler hz finished? cpus)))
    (else
-    (let* ((scheduler (make-scheduler #:parallelism parallelism))
+    (let* ((scheduler (make-scheduler #:parallelism parallelism
+                                      #:deadline-ordered? deadline-ordered?))
            (ret (make-atomic-box #f))
            (finished? (lambda ()
                         (and (atomic-box-ref ret)
@@ -161,18 +309,26 @@
       (destroy-scheduler scheduler)
       (apply values (atomic-box-ref ret))))))
 
-(define* (spawn-fiber thunk #:optional scheduler #:key parallel?)
+(define* (spawn-fiber thunk #:optional scheduler #:key parallel?
+                      (deadline (current-task-deadline)))
   "Spawn a new fiber which will start by invoking @var{thunk}.
 The fiber will be scheduled on the next turn.  @var{thunk} will run
 with a copy of the current dynamic state, isolating fluid and
-parameter mutations to the fiber."
+parameter mutations to the fiber.  @var{deadline} is the fiber's
+deadline, in internal time units, used to order the fiber on
+deadline-ordered schedulers; it defaults to the deadline of the
+current fiber."
   (define (capture-dynamic-state thunk)
     (let ((dynamic-state (current-dynamic-state)))
       (lambda ()
-        (with-dynamic-state dynamic-state thunk))))
+        (with-dynamic-state dynamic-state
+                            (lambda ()
+                              (current-task-deadline deadline)
+                              (thunk))))))
   (define (create-fiber sched thunk)
     (schedule-task sched
-                   (capture-dynamic-state thunk)))
+                   (capture-dynamic-state thunk)
+                   deadline))
   (cond
    (scheduler
     ;; When a scheduler is passed explicitly, it could be there is no
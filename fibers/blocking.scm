@@ -0,0 +1,156 @@
+;; Running blocking calls on a thread pool
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Some calls block the kernel thread no matter what: reads and
+;;; writes on regular files, which epoll always reports as ready,
+;;; name resolution, fsync, waitpid, and so on.  Calling them from a
+;;; fiber stalls all the other fibers of its scheduler.  This module
+;;; runs such calls on a bounded pool of worker threads instead, as an
+;;; operation, so that the calling fiber suspends until the call is
+;;; done.
+
+(define-module (fibers blocking)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 atomic)
+  #:use-module (ice-9 match)
+  #:use-module (ice-9 threads)
+  #:use-module (fibers deque)
+  #:use-module (fibers operations)
+  #:export (make-blocking-pool
+            blocking-pool?
+            default-blocking-pool
+            blocking-operation
+            call-blocking))
+
+(define-record-type <blocking-pool>
+  (%make-blocking-pool mutex condvar size jobs thread-count idle-count)
+  blocking-pool?
+  (mutex blocking-pool-mutex)
+  (condvar blocking-pool-condvar)
+  ;; uint, the maximum number of worker threads
+  (size blocking-pool-size)
+  ;; deque of thunks, protected by the mutex
+  (jobs blocking-pool-jobs set-blocking-pool-jobs!)
+  ;; uint, protected by the mutex
+  (thread-count blocking-pool-thread-count set-blocking-pool-thread-count!)
+  ;; uint, protected by the mutex
+  (idle-count blocking-pool-idle-count set-blocking-pool-idle-count!))
+
+(set-record-type-printer!
+ <blocking-pool>
+ (lambda (pool port)
+   (format port "#<blocking-pool ~a>" (blocking-pool-size pool))))
+
+(define* (make-blocking-pool #:key (size (max 4 (current-processor-count))))
+  "Make a pool of up to @var{size} worker threads on which to run
+blocking calls.  Threads are started on demand and stay around
+afterwards."
+  (%make-blocking-pool (make-mutex) (make-condition-variable) size
+                       (make-empty-deque) 0 0))
+
+(define *default-pool* (make-atomic-box #f))
+
+(define (default-blocking-pool)
+  "Return the blocking pool that is used when no pool is given
+explicitly, creating it if needed."
+  (or (atomic-box-ref *default-pool*)
+      (let ((pool (make-blocking-pool)))
+        (or (atomic-box-compare-and-swap! *default-pool* #f pool)
+            pool))))
+
+(define (next-job! pool)
+  "Return the next job of @var{pool}, waiting until there is one.
+Must be called with the mutex of @var{pool} held."
+  (call-with-values (lambda () (dequeue (blocking-pool-jobs pool)))
+    (lambda (jobs job)
+      (cond
+       (jobs
+        (set-blocking-pool-jobs! pool jobs)
+        job)
+       (else
+        (set-blocking-pool-idle-count! pool
+                                       (1+ (blocking-pool-idle-count pool)))
+        (wait-condition-variable (blocking-pool-condvar pool)
+                                 (blocking-pool-mutex pool))
+        (set-blocking-pool-idle-count! pool
+                                       (1- (blocking-pool-idle-count pool)))
+        (next-job! pool))))))
+
+(define (run-worker pool)
+  (let ((mutex (blocking-pool-mutex pool)))
+    (let lp ()
+      (lock-mutex mutex)
+      (let ((job (next-job! pool)))
+        (unlock-mutex mutex)
+        (job)
+        (lp)))))
+
+(define (submit-job! pool job)
+  "Arrange for @var{job} to be called on a worker thread of
+@var{pool}."
+  (let ((mutex (blocking-pool-mutex pool)))
+    (call-with-blocked-asyncs
+     (lambda ()
+       (lock-mutex mutex)
+       (set-blocking-pool-jobs! pool (enqueue (blocking-pool-jobs pool) job))
+       (cond
+        ((positive? (blocking-pool-idle-count pool))
+         (signal-condition-variable (blocking-pool-condvar pool)))
+        ((< (blocking-pool-thread-count pool) (blocking-pool-size pool))
+         (set-blocking-pool-thread-count! pool
+                                          (1+ (blocking-pool-thread-count pool)))
+         (call-with-new-thread (lambda () (run-worker pool)))))
+       (unlock-mutex mutex)))))
+
+(define* (blocking-operation thunk #:optional (pool (default-blocking-pool)))
+  "Make an operation that calls @var{thunk} on a worker thread of
+@var{pool} and succeeds with the values that @var{thunk} returns.  If
+@var{thunk} raises an exception, performing the operation raises it
+again in the fiber.
+
+If another operation of a choice succeeds first, for example a
+timeout, the values of @var{thunk} are discarded.  @var{thunk} is not
+called at all if the choice was decided before a worker picked it up,
+but a call that has already started runs to completion."
+  (make-base-operation
+   #f
+   (lambda () #f)
+   (lambda (flag sched resume)
+     (define (commit result)
+       (match (atomic-box-compare-and-swap! flag 'W 'S)
+         ('W (resume result))
+         ('C (commit result))
+         ('S #f)))
+     (submit-job!
+      pool
+      (lambda ()
+        (unless (eq? (atomic-box-ref flag) 'S)
+          (commit
+           (catch #t
+             (lambda ()
+               (call-with-values thunk
+                 (lambda vals
+                   (lambda () (apply values vals)))))
+             (lambda (key . args)
+               (lambda () (apply throw key args)))))))))))
+
+(define* (call-blocking thunk #:optional (pool (default-blocking-pool)))
+  "Call @var{thunk} on a worker thread of @var{pool}, suspending the
+current fiber until it returns, and return its values.  Equivalent to
+@code{(perform-operation (blocking-operation thunk pool))}."
+  (perform-operation (blocking-operation thunk pool)))
@@ -0,0 +1,240 @@
+;; Broadcast channels
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; A broadcast channel delivers every published message to every
+;;; subscriber.  Unlike with channels, publishing doesn't rendezvous
+;;; with the receivers: the publisher stores the message once in a ring
+;;; of recent messages and wakes the subscribers that are waiting, and
+;;; each subscriber reads the ring at its own cursor.
+;;;
+;;; Each slot of the ring is an atomic box holding a pair of the
+;;; message's sequence number and the message, so a subscriber can tell
+;;; whether the message it wants has been overwritten by a newer one.
+;;; What happens then depends on the broadcast's policy for slow
+;;; subscribers: with 'drop, the subscriber silently skips to the
+;;; oldest message still in the ring; with 'lag-error, it skips there
+;;; too but gets an error first; and with 'block, it never happens
+;;; because the publisher waits for the slowest subscriber instead.
+;;;
+;;; Waiting subscribers are kept on a stack of flag+resume pairs and
+;;; woken with the helpers from waiters.scm.
+
+(define-module (fibers broadcast)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 atomic)
+  #:use-module (ice-9 match)
+  #:use-module (fibers stack)
+  #:use-module (fibers counter)
+  #:use-module (fibers conditions)
+  #:use-module (fibers mutex)
+  #:use-module (fibers operations)
+  #:use-module (fibers waiters)
+  #:export (make-broadcast
+            broadcast?
+            publish!
+            subscribe
+            unsubscribe!
+            subscription?
+            subscription-get-operation
+            subscription-get))
+
+(define-record-type <broadcast>
+  (%make-broadcast policy slots head waiters gc-step
+                   subscribers space publish-mutex)
+  broadcast?
+  ;; one of 'drop, 'block or 'lag-error
+  (policy broadcast-policy)
+  ;; vector of atomic boxes of #f or seq+message pairs
+  (slots broadcast-slots)
+  ;; atomic box of uint: sequence number of the next message
+  (head broadcast-head)
+  ;; stack of flag+resume pairs
+  (waiters broadcast-waiters)
+  ;; count until garbage collection
+  (gc-step broadcast-gc-step)
+  ;; atomic box of list of subscriptions, only kept for 'block
+  (subscribers broadcast-subscribers)
+  ;; atomic box of #f, or a condition that a blocked publisher waits on
+  (space broadcast-space)
+  ;; mutex serializing publishers
+  (publish-mutex broadcast-publish-mutex))
+
+(define-record-type <subscription>
+  (%make-subscription broadcast cursor)
+  subscription?
+  (broadcast subscription-broadcast)
+  ;; atomic box of uint: sequence number of the next message to read
+  (cursor subscription-cursor))
+
+(set-record-type-printer!
+ <broadcast>
+ (lambda (bc port)
+   (format port "#<broadcast ~a ~a/~a>"
+           (broadcast-policy bc)
+           (atomic-box-ref (broadcast-head bc))
+           (vector-length (broadcast-slots bc)))))
+
+(define* (make-broadcast #:key (capacity 64) (policy 'drop))
+  "Make a broadcast channel that keeps the last @var{capacity}
+messages for slow subscribers.  @var{policy} says what happens when a
+subscriber falls further behind than that: @code{drop} skips the
+missed messages, @code{lag-error} skips them but raises an error in
+the subscriber first, and @code{block} makes publishers wait for the
+slowest subscriber."
+  (unless (memq policy '(drop block lag-error))
+    (error "unknown broadcast policy" policy))
+  (unless (and (exact-integer? capacity) (positive? capacity))
+    (error "capacity should be a positive integer" capacity))
+  (let ((slots (make-vector capacity #f)))
+    (let lp ((i 0))
+      (when (< i capacity)
+        (vector-set! slots i (make-atomic-box #f))
+        (lp (1+ i))))
+    (%make-broadcast policy slots (make-atomic-box 0)
+                     (make-empty-stack) (make-counter)
+                     (make-atomic-box '()) (make-atomic-box #f)
+                     (make-mutex))))
+
+(define (update! box f)
+  (let spin ((x (atomic-box-ref box)))
+    (let ((x* (atomic-box-compare-and-swap! box x (f x))))
+      (unless (eq? x x*)
+        (spin x*)))))
+
+(define (subscribe bc)
+  "Subscribe to @var{bc}, and return a subscription that receives the
+messages published from now on.  A subscription should only be read by
+one fiber at a time."
+  (let ((sub (%make-subscription bc (make-atomic-box
+                                     (atomic-box-ref (broadcast-head bc))))))
+    (when (eq? (broadcast-policy bc) 'block)
+      (update! (broadcast-subscribers bc) (lambda (subs) (cons sub subs)))
+      ;; Messages published between reading the head and registering
+      ;; the subscription might have overwritten what the cursor points
+      ;; to; start after them.
+      (atomic-box-set! (subscription-cursor sub)
+                       (atomic-box-ref (broadcast-head bc))))
+    sub))
+
+(define (notify-space! bc)
+  (when (atomic-box-ref (broadcast-space bc))
+    (let ((cvar (atomic-box-swap! (broadcast-space bc) #f)))
+      (when cvar
+        (signal-condition! cvar)))))
+
+(define (unsubscribe! sub)
+  "Stop receiving messages on @var{sub}.  With the @code{block} policy,
+publishers no longer wait for @var{sub} to catch up."
+  (let ((bc (subscription-broadcast sub)))
+    (when (eq? (broadcast-policy bc) 'block)
+      (update! (broadcast-subscribers bc)
+               (lambda (subs) (delq sub subs)))
+      (notify-space! bc))))
+
+(define (slowest-cursor bc head)
+  (let lp ((subs (atomic-box-ref (broadcast-subscribers bc))) (min head))
+    (match subs
+      (() min)
+      ((sub . subs)
+       (lp subs (let ((cursor (atomic-box-ref (subscription-cursor sub))))
+                  (if (< cursor min) cursor min)))))))
+
+(define (wait-for-space! bc seq)
+  (define (full?)
+    (<= (vector-length (broadcast-slots bc)) (- seq (slowest-cursor bc seq))))
+  (when (full?)
+    (let ((cvar (make-condition)))
+      (atomic-box-set! (broadcast-space bc) cvar)
+      ;; Check again, in case a subscriber caught up before it could
+      ;; see our condition.
+      (when (full?)
+        (wait cvar))
+      (wait-for-space! bc seq))))
+
+(define (publish! bc message)
+  "Publish @var{message} to all subscribers of @var{bc}, waking those
+that are waiting for a message.  With the @code{block} policy, first
+wait until the slowest subscriber has room for it."
+  (match bc
+    (($ <broadcast> policy slots head waiters)
+     (with-mutex (broadcast-publish-mutex bc)
+       (let ((seq (atomic-box-ref head)))
+         (when (eq? policy 'block)
+           (wait-for-space! bc seq))
+         (atomic-box-set! (vector-ref slots (modulo seq (vector-length slots)))
+                          (cons seq message))
+         (atomic-box-set! head (1+ seq))))
+     (resume-waiters! waiters))))
+
+(define (take-message! sub)
+  (match sub
+    (($ <subscription> bc cursor)
+     (match bc
+       (($ <broadcast> policy slots head)
+        (let* ((seq (atomic-box-ref cursor))
+               (capacity (vector-length slots)))
+          (match (atomic-box-ref (vector-ref slots (modulo seq capacity)))
+            ((seq* . message)
+             (cond
+              ((eqv? seq* seq)
+               (atomic-box-set! cursor (1+ seq))
+               (when (eq? policy 'block)
+                 (notify-space! bc))
+               message)
+              (else
+               ;; Overwritten; skip to the oldest message in the ring.
+               (let ((oldest (max seq (- (atomic-box-ref head) capacity))))
+                 (atomic-box-set! cursor oldest)
+                 (if (eq? policy 'lag-error)
+                     (scm-error 'broadcast-lagged "subscription-get"
+                                "Subscriber missed ~a messages"
+                                (list (- oldest seq)) (list (- oldest seq)))
+                     (take-message! sub)))))))))))))
+
+(define (subscription-get-operation sub)
+  "Make an operation that succeeds with the next message published on
+the broadcast of @var{sub}."
+  (match sub
+    (($ <subscription> bc cursor)
+     (match bc
+       (($ <broadcast> policy slots head waiters gc-step)
+        (define (ready?)
+          (< (atomic-box-ref cursor) (atomic-box-ref head)))
+        (define (try-fn)
+          (and (ready?)
+               (lambda () (take-message! sub))))
+        (define (block-fn flag sched resume)
+          ;; resume-waiter! resumes with 'values'; take the message
+          ;; instead.
+          (define (resume-take _)
+            (resume (lambda () (take-message! sub))))
+          (collect-garbage! waiters gc-step)
+          (stack-push! waiters (cons flag resume-take))
+          ;; A message may have been published between the calls to
+          ;; try-fn and block-fn, possibly before publish! could see
+          ;; our push.  Only resume ourselves: other waiters may be
+          ;; waiting for a message that isn't there yet.
+          (when (ready?)
+            (resume-waiter! flag resume-take))
+          (values))
+        (make-base-operation #f try-fn block-fn))))))
+
+(define (subscription-get sub)
+  "Wait for the next message published on the broadcast of @var{sub},
+and return it."
+  (perform-operation (subscription-get-operation sub)))
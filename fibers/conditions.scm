@@ -34,11 +34,27 @@
   #:use-module (fibers stack)
   #:use-module (fibers counter)
   #:use-module (fibers operations)
+  #:use-module (fibers waiters)
   #:export (make-condition
             condition?
             signal-condition!
             wait-operation
-            wait))
+            wait
+
+            make-wait-group
+            wait-group?
+            wait-group-add!
+            wait-group-done!
+            wait-group-wait-operation
+            wait-group-wait
+
+            make-event
+            event?
+            event-set?
+            set-event!
+            reset-event!
+            event-wait-operation
+            event-wait))
 
 (define-record-type <condition>
   (%make-condition signalled? waiters gc-step)
@@ -54,21 +70,6 @@
   "Make a fresh condition variable."
   (%make-condition (make-atomic-box #f) (make-empty-stack) (make-counter)))
 
-(define (resume-waiters! waiters)
-  (define (resume-one flag resume)
-    (match (atomic-box-compare-and-swap! flag 'W 'S)
-      ('W (resume values))
-      ('C (resume-one flag resume))
-      ('S #f)))
-  ;; Non-tail-recursion to resume waiters in the order they were added
-  ;; to the waiters stack.
-  (let lp ((waiters (stack-pop-all! waiters)))
-    (match waiters
-      (() #f)
-      (((flag . resume) . waiters)
-       (lp waiters)
-       (resume-one flag resume)))))
-
 (define (signal-condition! cvar)
   "Mark @var{cvar} as having been signalled.  Resume any fiber or
 thread waiting for @var{cvar}.  If @var{cvar} is already signalled,
@@ -89,21 +90,7 @@ returns @code{#t} otherwise."
     (($ <condition> signalled? waiters gc-step)
      (define (try-fn) (and (atomic-box-ref signalled?) values))
      (define (block-fn flag sched resume)
-       ;; Decrement the garbage collection counter.
-       ;; If we've surpassed the number of steps until garbage collection,
-       ;; prune out waiters that have already succeeded.
-       ;;
-       ;; Note that it's possible that this number will go negative,
-       ;; but stack-filter! should handle this without errors (though
-       ;; possibly extra spin), and testing against zero rather than
-       ;; less than zero will prevent multiple threads from repeating
-       ;; this work.
-       (when (= (counter-decrement! gc-step) 0)
-         (stack-filter! waiters
-                        (match-lambda
-                          ((flag . resume)
-                           (not (eq? (atomic-box-ref flag) 'S)))))
-         (counter-reset! gc-step))
+       (collect-garbage! waiters gc-step)
        ;; We have suspended the current fiber or thread; arrange for
        ;; signal-condition! to call resume-get by adding the flag and
        ;; resume callback to the cvar's waiters stack.
@@ -120,3 +107,147 @@ returns @code{#t} otherwise."
 (define (wait cvar)
   "Wait until @var{cvar} has been signalled."
   (perform-operation (wait-operation cvar)))
+
+;;; Wait groups
+
+(define-record-type <wait-group>
+  (%make-wait-group count waiters gc-step)
+  wait-group?
+  ;; atomic box of uint
+  (count wait-group-count)
+  ;; stack of flag+resume pairs
+  (waiters wait-group-waiters)
+  ;; count until garbage collection
+  (gc-step wait-group-gc-step))
+
+(define* (make-wait-group #:optional (count 0))
+  "Make a fresh wait group, waiting for @var{count} tasks."
+  (%make-wait-group (make-atomic-box count) (make-empty-stack)
+                    (make-counter)))
+
+(define (wait-group-add! wg n)
+  "Add @var{n} to the number of tasks that @var{wg} waits for.  When
+the number drops to zero, resume any fiber or thread waiting for
+@var{wg}."
+  (match wg
+    (($ <wait-group> count waiters)
+     (let spin ((x (atomic-box-ref count)))
+       (let ((x-new (+ x n)))
+         (when (negative? x-new)
+           (error "wait group count would become negative" wg))
+         (let ((x* (atomic-box-compare-and-swap! count x x-new)))
+           (cond
+            ((not (eqv? x* x)) (spin x*))
+            ((zero? x-new) (resume-waiters! waiters))
+            (else #t))))))))
+
+(define (wait-group-done! wg)
+  "Mark one of the tasks that @var{wg} waits for as done."
+  (wait-group-add! wg -1))
+
+(define (wait-group-wait-operation wg)
+  "Make an operation that will complete when no tasks of @var{wg} are
+outstanding."
+  (match wg
+    (($ <wait-group> count waiters gc-step)
+     (define (try-fn) (and (zero? (atomic-box-ref count)) values))
+     (define (block-fn flag sched resume)
+       (collect-garbage! waiters gc-step)
+       (stack-push! waiters (cons flag resume))
+       ;; As in wait-operation, resolve the race with a count that
+       ;; reached zero between the calls to try-fn and block-fn.
+       (when (zero? (atomic-box-ref count))
+         (resume-waiters! waiters))
+       (values))
+     (make-base-operation #f try-fn block-fn))))
+
+(define (wait-group-wait wg)
+  "Wait until no tasks of @var{wg} are outstanding."
+  (perform-operation (wait-group-wait-operation wg)))
+
+;;; Resettable events
+
+(define-record-type <event>
+  (%make-event generation waiters gc-step)
+  event?
+  ;; atomic box of uint, which is odd while the event is set
+  (generation event-generation)
+  ;; stack of flag+resume+generation triples
+  (waiters event-waiters)
+  ;; count until garbage collection
+  (gc-step event-gc-step))
+
+(define (make-event)
+  "Make a fresh event, which is not set."
+  (%make-event (make-atomic-box 0) (make-empty-stack) (make-counter)))
+
+(define (event-set? ev)
+  "Return @code{#t} if @var{ev} is set, or @code{#f} otherwise."
+  (odd? (atomic-box-ref (event-generation ev))))
+
+(define (resume-event-waiters! waiters generation)
+  ;; Resume the waiters that started waiting before GENERATION, and
+  ;; put back any that arrived after the event was already reset again.
+  (let lp ((waiters* (stack-pop-all! waiters)))
+    (match waiters*
+      (() #f)
+      (((and waiter (flag resume . since)) . waiters*)
+       (lp waiters*)
+       (if (< since generation)
+           (resume-waiter! flag resume)
+           (stack-push! waiters waiter))))))
+
+(define (set-event! ev)
+  "Set @var{ev}, resuming any fiber or thread waiting for it.  Return
+@code{#f} if @var{ev} was already set, or @code{#t} otherwise."
+  (match ev
+    (($ <event> generation waiters)
+     (let spin ((gen (atomic-box-ref generation)))
+       (cond
+        ((odd? gen) #f)
+        (else
+         (let ((gen* (atomic-box-compare-and-swap! generation gen (1+ gen))))
+           (cond
+            ((eqv? gen* gen)
+             (resume-event-waiters! waiters (1+ gen))
+             #t)
+            (else (spin gen*))))))))))
+
+(define (reset-event! ev)
+  "Reset @var{ev}, so that waiting for it blocks until it is set again.
+Return @code{#f} if @var{ev} was not set, or @code{#t} otherwise."
+  (match ev
+    (($ <event> generation)
+     (let spin ((gen (atomic-box-ref generation)))
+       (cond
+        ((even? gen) #f)
+        (else
+         (let ((gen* (atomic-box-compare-and-swap! generation gen (1+ gen))))
+           (or (eqv? gen* gen)
+               (spin gen*)))))))))
+
+(define (event-wait-operation ev)
+  "Make an operation that will complete when @var{ev} is set, or that
+has been set since the operation started waiting."
+  (match ev
+    (($ <event> generation waiters gc-step)
+     (define (try-fn) (and (odd? (atomic-box-ref generation)) values))
+     (define (block-fn flag sched resume)
+       (collect-garbage! waiters gc-step)
+       (let ((gen (atomic-box-ref generation)))
+         (cond
+          ((odd? gen)
+           ;; Set between the calls to try-fn and block-fn.
+           (resume-waiter! flag resume))
+          (else
+           (stack-push! waiters (cons* flag resume gen))
+           ;; If the generation changed since we read it, the event was
+           ;; set, perhaps before set-event! could see our push.
+           (unless (eqv? gen (atomic-box-ref generation))
+             (resume-waiter! flag resume)))))
+       (values))
+     (make-base-operation #f try-fn block-fn))))
+
+(define (event-wait ev)
+  "Wait until @var{ev} is set."
+  (perform-operation (event-wait-operation ev)))
@@ -27,15 +27,19 @@
   #:use-module (srfi srfi-9 gnu)
   #:use-module (rnrs bytevectors)
   #:use-module (fibers config)
+  #:use-module ((fibers io-primitives) #:select (pipe2))
   #:export (events-impl-create
             events-impl-destroy
             events-impl?
             events-impl-add!
+            events-impl-remove!
             events-impl-wake!
             events-impl-fd-finalizer
             events-impl-run
+            events-impl-now
 
-            EVENTS_IMPL_READ EVENTS_IMPL_WRITE EVENTS_IMPL_CLOSED_OR_ERROR))
+            EVENTS_IMPL_READ EVENTS_IMPL_WRITE EVENTS_IMPL_CLOSED_OR_ERROR
+            EVENTS_IMPL_EXCLUSIVE))
 
 (dynamic-call "init_fibers_epoll"
               (dynamic-link (extension-library "fibers-epoll")))
@@ -44,6 +48,8 @@
   (export EPOLLRDHUP))
 (when (defined? 'EPOLLONESHOT)
   (export EPOLLONESHOT))
+(when (defined? 'EPOLLEXCLUSIVE)
+  (export EPOLLEXCLUSIVE))
 
 (define (make-wake-pipe)
   (let ((pair (pipe2 (logior O_NONBLOCK O_CLOEXEC))))
@@ -158,8 +164,9 @@ epoll wait (if appropriate)."
   (define (expiry->timeout expiry)
     (cond
      ((not expiry) -1)
+     ((eqv? expiry 0) 0)
      (else
-      (let ((now (get-internal-real-time)))
+      (let ((now (primitive-monotonic-time)))
         (cond
          ((< expiry now) 0)
          (else (- expiry now)))))))
@@ -190,6 +197,11 @@ epoll wait (if appropriate)."
 (define EVENTS_IMPL_READ (logior EPOLLIN EPOLLRDHUP))
 (define EVENTS_IMPL_WRITE EPOLLOUT)
 (define EVENTS_IMPL_CLOSED_OR_ERROR (logior EPOLLHUP EPOLLERR))
+;; Wake only one of the schedulers waiting on an fd, where supported.
+(define EVENTS_IMPL_EXCLUSIVE
+  (if (defined? 'EPOLLEXCLUSIVE)
+      EPOLLEXCLUSIVE ; Linux 4.5 and later
+      0))
 
 (define events-impl-create epoll-create)
 
@@ -199,7 +211,32 @@ epoll wait (if appropriate)."
   (epoll? impl))
 
 (define (events-impl-add! impl fd events)
-  (epoll-add*! impl fd (logior events EPOLLONESHOT)))
+  (if (zero? (logand events EVENTS_IMPL_EXCLUSIVE))
+      (epoll-add*! impl fd (logior events EPOLLONESHOT))
+      ;; EPOLLEXCLUSIVE can't be combined with EPOLLONESHOT, nor
+      ;; modified once added, so the scheduler removes exclusive
+      ;; registrations with events-impl-remove! after each wakeup.
+      ;; The kernel also rejects it together with EPOLLRDHUP; a peer
+      ;; that hangs up still makes the fd readable, so plain EPOLLIN is
+      ;; enough.
+      (let ((events (logand events (lognot EPOLLRDHUP))))
+        (catch 'system-error
+          (lambda () (epoll-add! impl fd events))
+          (lambda args
+            ;; A spent one-shot registration for FD may still be in
+            ;; the set; replace it.
+            (unless (eqv? (system-error-errno args) EEXIST)
+              (apply throw args))
+            (events-impl-remove! impl fd)
+            (epoll-add! impl fd events))))))
+
+(define (events-impl-remove! impl fd)
+  (catch 'system-error
+    (lambda () (epoll-remove! impl fd))
+    (lambda args
+      ;; FD may have been closed or removed in the meantime.
+      (unless (memv (system-error-errno args) (list ENOENT EBADF))
+        (apply throw args)))))
 
 (define events-impl-wake! epoll-wake!)
 
@@ -218,3 +255,5 @@ epoll wait (if appropriate)."
     (set-car! fd-waiters #f)))
 
 (define events-impl-run epoll)
+
+(define events-impl-now primitive-monotonic-time)
@@ -19,11 +19,14 @@
 	    events-impl-destroy
 	    events-impl?
 	    events-impl-add!
+	    events-impl-remove!
 	    events-impl-wake!
 	    events-impl-fd-finalizer
 	    events-impl-run
+	    events-impl-now
 
-	    EVENTS_IMPL_READ EVENTS_IMPL_WRITE EVENTS_IMPL_CLOSED_OR_ERROR))
+	    EVENTS_IMPL_READ EVENTS_IMPL_WRITE EVENTS_IMPL_CLOSED_OR_ERROR
+	    EVENTS_IMPL_EXCLUSIVE))
 
 ;; When cross-compiling, the cross-compiled 'fibers-libevent.so' cannot be loaded
 ;; by the 'guild compile' process, so during the compilation of Guile-Fibers
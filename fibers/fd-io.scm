@@ -0,0 +1,419 @@
+;; Bytevector I/O on file descriptors
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Operations that read and write bytevectors directly on nonblocking
+;;; file descriptors, without going through Guile's port layer.  Each
+;;; operation tries the system call once, and if it would block, waits
+;;; for the file descriptor to become ready and tries again.
+;;;
+;;; Vectored operations take a list of slices, each of which is either a
+;;; bytevector or a list of a bytevector, a start index and a count.
+;;;
+;;; These operations bypass port buffers.  Don't mix them with port I/O
+;;; on the same file descriptor unless the port is unbuffered.
+
+(define-module (fibers fd-io)
+  #:use-module (srfi srfi-9)
+  #:use-module (rnrs bytevectors)
+  #:use-module (ice-9 match)
+  #:use-module (fibers io-primitives)
+  #:use-module (fibers io-wakeup)
+  #:use-module (fibers operations)
+  #:use-module (fibers scheduler)
+  #:export (fd-read-operation
+            fd-write-operation
+            fd-recv-operation
+            fd-send-operation
+            fd-readv-operation
+            fd-writev-operation
+            fd-read!
+            fd-write
+            fd-recv!
+            fd-send
+            fd-readv!
+            fd-writev
+            fd-write-all
+            fd-writev-all
+            sendfile-operation
+            splice-operation
+            sendfile
+            splice
+            sendfile-all
+            splice-all
+
+            make-datagram-batch
+            datagram-batch?
+            datagram-batch-capacity
+            datagram-batch-slot-size
+            datagram-batch-count
+            datagram-batch-bytes
+            datagram-batch-start
+            datagram-batch-length
+            datagram-batch-ref
+            datagram-batch-truncated?
+            datagram-batch-set!
+            set-datagram-batch-count!
+            recv-datagrams-operation
+            send-datagrams-operation
+            recv-datagrams!
+            send-datagrams))
+
+(define (->fd fd)
+  (if (port? fd) (fileno fd) fd))
+
+(define (try-transfer transfer)
+  (lambda ()
+    (let ((count (transfer)))
+      (and count (lambda () count)))))
+
+(define* (fd-read-operation fd bv #:optional (start 0)
+                            (count (- (bytevector-length bv) start)))
+  "Make an operation that reads up to @var{count} bytes from the file
+descriptor or port @var{fd} into @var{bv}, starting at @var{start}.
+The operation succeeds with the number of bytes read, which is zero at
+end of file."
+  (let ((fd (->fd fd)))
+    (make-fd-read-operation
+     (try-transfer (lambda () (primitive-fd-read fd bv start count)))
+     fd)))
+
+(define* (fd-write-operation fd bv #:optional (start 0)
+                             (count (- (bytevector-length bv) start)))
+  "Make an operation that writes up to @var{count} bytes from @var{bv},
+starting at @var{start}, to the file descriptor or port @var{fd}.  The
+operation succeeds with the number of bytes written, which may be less
+than @var{count}."
+  (let ((fd (->fd fd)))
+    (make-fd-write-operation
+     (try-transfer (lambda () (primitive-fd-write fd bv start count)))
+     fd)))
+
+(define* (fd-recv-operation fd bv #:optional (start 0)
+                            (count (- (bytevector-length bv) start))
+                            (flags 0))
+  "Like @code{fd-read-operation}, but receive from the socket @var{fd}
+with @code{recv}, passing @var{flags}."
+  (let ((fd (->fd fd)))
+    (make-fd-read-operation
+     (try-transfer (lambda () (primitive-fd-recv fd bv start count flags)))
+     fd)))
+
+(define* (fd-send-operation fd bv #:optional (start 0)
+                            (count (- (bytevector-length bv) start))
+                            (flags 0))
+  "Like @code{fd-write-operation}, but send to the socket @var{fd} with
+@code{send}, passing @var{flags}.  Sending on a closed connection
+raises an @code{EPIPE} error instead of a @code{SIGPIPE} signal, where
+the system supports it."
+  (let ((fd (->fd fd)))
+    (make-fd-write-operation
+     (try-transfer (lambda () (primitive-fd-send fd bv start count flags)))
+     fd)))
+
+(define (fd-readv-operation fd slices)
+  "Make an operation that reads from the file descriptor or port
+@var{fd} into the bytevector slices @var{slices}, filling them in
+order, with one @code{readv} call.  The operation succeeds with the
+number of bytes read, which is zero at end of file."
+  (let ((fd (->fd fd)))
+    (make-fd-read-operation
+     (try-transfer (lambda () (primitive-fd-readv fd slices)))
+     fd)))
+
+(define (fd-writev-operation fd slices)
+  "Make an operation that writes the bytevector slices @var{slices} in
+order to the file descriptor or port @var{fd}, with one @code{writev}
+call.  The operation succeeds with the number of bytes written, which
+may be less than the total size of @var{slices}."
+  (let ((fd (->fd fd)))
+    (make-fd-write-operation
+     (try-transfer (lambda () (primitive-fd-writev fd slices)))
+     fd)))
+
+(define* (fd-read! fd bv #:optional (start 0)
+                   (count (- (bytevector-length bv) start)))
+  "Read up to @var{count} bytes from @var{fd} into @var{bv} and return
+the number of bytes read.  Equivalent to @code{(perform-operation
+(fd-read-operation fd bv start count))}."
+  (perform-operation (fd-read-operation fd bv start count)))
+
+(define* (fd-write fd bv #:optional (start 0)
+                   (count (- (bytevector-length bv) start)))
+  "Write up to @var{count} bytes from @var{bv} to @var{fd} and return
+the number of bytes written.  Equivalent to @code{(perform-operation
+(fd-write-operation fd bv start count))}."
+  (perform-operation (fd-write-operation fd bv start count)))
+
+(define* (fd-recv! fd bv #:optional (start 0)
+                   (count (- (bytevector-length bv) start))
+                   (flags 0))
+  "Receive up to @var{count} bytes from the socket @var{fd} into
+@var{bv} and return the number of bytes received."
+  (perform-operation (fd-recv-operation fd bv start count flags)))
+
+(define* (fd-send fd bv #:optional (start 0)
+                  (count (- (bytevector-length bv) start))
+                  (flags 0))
+  "Send up to @var{count} bytes from @var{bv} on the socket @var{fd} and
+return the number of bytes sent."
+  (perform-operation (fd-send-operation fd bv start count flags)))
+
+(define (fd-readv! fd slices)
+  "Read from @var{fd} into @var{slices} and return the number of bytes
+read."
+  (perform-operation (fd-readv-operation fd slices)))
+
+(define (fd-writev fd slices)
+  "Write @var{slices} to @var{fd} and return the number of bytes
+written."
+  (perform-operation (fd-writev-operation fd slices)))
+
+(define* (fd-write-all fd bv #:optional (start 0)
+                       (count (- (bytevector-length bv) start)))
+  "Write all @var{count} bytes of @var{bv} from @var{start} to
+@var{fd}, retrying partial writes."
+  (let lp ((start start) (count count))
+    (when (positive? count)
+      (let ((written (fd-write fd bv start count)))
+        (lp (+ start written) (- count written))))))
+
+(define (drop-slices slices n)
+  "Return the slices that remain of @var{slices} after the first @var{n}
+bytes."
+  (match slices
+    (() '())
+    ((slice . slices*)
+     (match slice
+       ((? bytevector? bv)
+        (drop-slices (cons (list bv 0 (bytevector-length bv)) slices*) n))
+       ((bv start count)
+        (if (< n count)
+            (cons (list bv (+ start n) (- count n)) slices*)
+            (drop-slices slices* (- n count))))))))
+
+(define (fd-writev-all fd slices)
+  "Write all of @var{slices} to @var{fd}, retrying partial writes."
+  (let lp ((slices slices))
+    (unless (null? slices)
+      (lp (drop-slices slices (fd-writev fd slices))))))
+
+(define* (sendfile-operation out in count #:optional offset)
+  "Make an operation that sends up to @var{count} bytes from the file
+@var{in} to the socket @var{out} with @code{sendfile}, without copying
+them through user space.  Start at @var{offset} in @var{in}, or at its
+current position if @var{offset} is @code{#f}, which then advances.
+The operation succeeds with the number of bytes sent, which is zero at
+end of file."
+  (let ((out (->fd out))
+        (in (->fd in)))
+    ;; Regular files are always ready, so only OUT can make us wait.
+    (make-fd-write-operation
+     (try-transfer (lambda () (primitive-fd-sendfile out in offset count)))
+     out)))
+
+(define (splice-operation in out count)
+  "Make an operation that moves up to @var{count} bytes from @var{in} to
+@var{out} with @code{splice}, without copying them through user space.
+One of @var{in} and @var{out} must be a pipe.  The operation succeeds
+with the number of bytes moved, which is zero at end of file."
+  (let ((in (->fd in))
+        (out (->fd out)))
+    (make-fd-wait-operation
+     (try-transfer (lambda () (primitive-fd-splice in out count)))
+     (lambda (sched task)
+       ;; splice doesn't say which side would have blocked, so wait
+       ;; for the one that is not ready.
+       (if (primitive-fd-readable? in)
+           (schedule-task-when-fd-writable sched out task)
+           (schedule-task-when-fd-readable sched in task))))))
+
+(define* (sendfile out in count #:optional offset)
+  "Send up to @var{count} bytes from @var{in} to @var{out} and return
+the number of bytes sent."
+  (perform-operation (sendfile-operation out in count offset)))
+
+(define (splice in out count)
+  "Move up to @var{count} bytes from @var{in} to @var{out} and return
+the number of bytes moved."
+  (perform-operation (splice-operation in out count)))
+
+(define* (sendfile-all out in count #:optional offset
+                       #:key (progress (lambda (sent) #t)))
+  "Send @var{count} bytes from @var{in} to @var{out}, or fewer if
+@var{in} ends first, and return the number of bytes sent.  After each
+chunk, call @var{progress} with the number of bytes sent so far."
+  (let lp ((sent 0))
+    (if (< sent count)
+        (let ((n (sendfile out in (- count sent) (and offset (+ offset sent)))))
+          (cond
+           ((zero? n) sent)
+           (else
+            (progress (+ sent n))
+            (lp (+ sent n)))))
+        sent)))
+
+(define O_CLOEXEC*
+  (if (defined? 'O_CLOEXEC)
+      O_CLOEXEC ; doesn't exist on guile-2.2
+      0))
+
+(define* (splice-all in out #:optional count
+                     #:key (progress (lambda (moved) #t)))
+  "Move @var{count} bytes from @var{in} to @var{out}, or until the end
+of @var{in} if @var{count} is @code{#f}, and return the number of bytes
+moved.  The bytes go through a pipe, so neither @var{in} nor @var{out}
+needs to be one.  After each chunk, call @var{progress} with the number
+of bytes moved so far."
+  (define chunk-size (* 64 1024))
+  (match (pipe2 (logior O_NONBLOCK O_CLOEXEC*))
+    ((pipe-in . pipe-out)
+     (dynamic-wind*
+       (lambda () #t)
+       (lambda ()
+         (let lp ((moved 0))
+           (let ((want (if count (min chunk-size (- count moved)) chunk-size)))
+             (if (zero? want)
+                 moved
+                 (let ((n (splice in pipe-out want)))
+                   (cond
+                    ((zero? n) moved)
+                    (else
+                     (let drain ((left n))
+                       (when (positive? left)
+                         (drain (- left (splice pipe-in out left)))))
+                     (progress (+ moved n))
+                     (lp (+ moved n)))))))))
+       (lambda ()
+         (close-port pipe-in)
+         (close-port pipe-out))))))
+
+;; A preallocated arena for receiving or sending many datagrams with one
+;; system call.  Datagram I lives at I * SLOT-SIZE in BYTES, and its
+;; length is the native uint32 at I * 4 in LENGTHS.  Byte I of TRUNCATED
+;; is 1 if datagram I was received truncated.
+(define-record-type <datagram-batch>
+  (%make-datagram-batch bytes slot-size lengths truncated count)
+  datagram-batch?
+  (bytes datagram-batch-bytes)
+  (slot-size datagram-batch-slot-size)
+  (lengths datagram-batch-lengths)
+  (truncated datagram-batch-truncated)
+  ;; uint, the number of datagrams in the batch
+  (count datagram-batch-count set-datagram-batch-count!))
+
+(define (make-datagram-batch capacity slot-size)
+  "Make a batch that holds up to @var{capacity} datagrams of up to
+@var{slot-size} bytes each."
+  (%make-datagram-batch (make-bytevector (* capacity slot-size) 0)
+                        slot-size
+                        (make-bytevector (* capacity 4) 0)
+                        (make-bytevector capacity 0)
+                        0))
+
+(define (datagram-batch-capacity batch)
+  (quotient (bytevector-length (datagram-batch-lengths batch)) 4))
+
+(define (datagram-batch-start batch i)
+  "Return the index in @code{(datagram-batch-bytes @var{batch})} at which
+datagram @var{i} starts."
+  (* i (datagram-batch-slot-size batch)))
+
+(define (datagram-batch-length batch i)
+  "Return the length of datagram @var{i} of @var{batch}."
+  (bytevector-u32-native-ref (datagram-batch-lengths batch) (* i 4)))
+
+(define (datagram-batch-ref batch i)
+  "Return a fresh bytevector with the contents of datagram @var{i} of
+@var{batch}."
+  (let* ((len (datagram-batch-length batch i))
+         (bv (make-bytevector len)))
+    (bytevector-copy! (datagram-batch-bytes batch)
+                      (datagram-batch-start batch i) bv 0 len)
+    bv))
+
+(define (datagram-batch-truncated? batch i)
+  "Return @code{#t} if datagram @var{i} of @var{batch} was longer than
+the slot size when it was received, so that only its first bytes were
+kept, or @code{#f} otherwise."
+  (not (zero? (bytevector-u8-ref (datagram-batch-truncated batch) i))))
+
+(define* (datagram-batch-set! batch i bv #:optional (start 0)
+                              (count (- (bytevector-length bv) start)))
+  "Copy @var{count} bytes of @var{bv} from @var{start} into datagram
+@var{i} of @var{batch}."
+  (unless (<= count (datagram-batch-slot-size batch))
+    (error "datagram too large for batch" count))
+  (bytevector-copy! bv start (datagram-batch-bytes batch)
+                    (datagram-batch-start batch i) count)
+  (bytevector-u32-native-set! (datagram-batch-lengths batch) (* i 4) count)
+  (bytevector-u8-set! (datagram-batch-truncated batch) i 0))
+
+(define (recv-datagrams-operation fd batch)
+  "Make an operation that receives as many datagrams as are available,
+up to the capacity of @var{batch}, from the socket @var{fd} into
+@var{batch}, with as few system calls as possible.  The operation
+succeeds with the number of datagrams received, which it also stores
+as the count of @var{batch}.  Datagrams longer than the slot size of
+@var{batch} are truncated, which @code{datagram-batch-truncated?}
+reports."
+  (let ((fd (->fd fd)))
+    (make-fd-read-operation
+     (lambda ()
+       (let ((n (primitive-fd-recvmmsg fd
+                                       (datagram-batch-bytes batch)
+                                       (datagram-batch-slot-size batch)
+                                       (datagram-batch-lengths batch)
+                                       (datagram-batch-truncated batch)
+                                       (datagram-batch-capacity batch))))
+         (and n
+              (lambda ()
+                (set-datagram-batch-count! batch n)
+                n))))
+     fd)))
+
+(define* (send-datagrams-operation fd batch #:optional (start 0)
+                                   (count (- (datagram-batch-count batch)
+                                             start)))
+  "Make an operation that sends datagrams @var{start} to
+@var{start}+@var{count}-1 of @var{batch} on the connected socket
+@var{fd}, with as few system calls as possible.  The operation succeeds
+with the number of datagrams sent, which may be less than @var{count}."
+  (let ((fd (->fd fd)))
+    (make-fd-write-operation
+     (try-transfer
+      (lambda ()
+        (primitive-fd-sendmmsg fd
+                               (datagram-batch-bytes batch)
+                               (datagram-batch-slot-size batch)
+                               (datagram-batch-lengths batch)
+                               start count)))
+     fd)))
+
+(define (recv-datagrams! fd batch)
+  "Receive datagrams from @var{fd} into @var{batch} and return how many
+were received."
+  (perform-operation (recv-datagrams-operation fd batch)))
+
+(define* (send-datagrams fd batch #:optional (start 0)
+                         (count (- (datagram-batch-count batch) start)))
+  "Send all of datagrams @var{start} to @var{start}+@var{count}-1 of
+@var{batch} on @var{fd}."
+  (let lp ((start start) (count count))
+    (when (positive? count)
+      (let ((sent (perform-operation
+                   (send-datagrams-operation fd batch start count))))
+        (lp (+ start sent) (- count sent))))))
@@ -0,0 +1,35 @@
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (fibers io-primitives)
+  #:export (primitive-fd-readable?
+            primitive-fd-writable?
+            primitive-fd-read
+            primitive-fd-write
+            primitive-fd-recv
+            primitive-fd-send
+            primitive-fd-readv
+            primitive-fd-writev
+            primitive-fd-sendfile
+            primitive-fd-splice
+            primitive-fd-recvmmsg
+            primitive-fd-sendmmsg
+            primitive-pidfd-open
+            primitive-signal-fd
+            pipe2))
+
+;; This module is left for the same reason as for events-impl.scm.  The
+;; real module is generated from io-primitives.scm.in.
@@ -18,6 +18,7 @@
 ;;;;
 
 (define-module (fibers io-wakeup)
+  #:use-module (fibers io-primitives)
   #:use-module (fibers scheduler)
   #:use-module (fibers operations)
   #:use-module (ice-9 atomic)
@@ -28,6 +29,9 @@
   #:use-module (ice-9 ports internal)
   #:export (make-read-operation
 	    make-write-operation
+	    make-fd-wait-operation
+	    make-fd-read-operation
+	    make-fd-write-operation
 	    wait-until-port-readable-operation
 	    wait-until-port-writable-operation
 	    accept-operation
@@ -52,16 +56,17 @@
 ;; These procedure are subject to spurious wakeups.
 
 (define (readable? port)
-  "Test if PORT is writable."
-  (match (select (vector port) #() #() 0)
-    ((#() #() #()) #f)
-    ((#(_) #() #()) #t)))
+  "Test if PORT is readable."
+  ;; Bytes already in the read buffer can be read without touching the
+  ;; file descriptor.
+  (let ((buf (port-read-buffer port)))
+    (or (< (port-buffer-cur buf) (port-buffer-end buf))
+        (port-buffer-has-eof? buf)
+        (primitive-fd-readable? (port-read-wait-fd port)))))
 
 (define (writable? port)
   "Test if PORT is writable."
-  (match (select #() (vector port) #() 0)
-    ((#() #() #()) #f)
-    ((#() #(_) #()) #t)))
+  (primitive-fd-writable? (port-write-wait-fd port)))
 
 (define (try-ready ready? port)
   (lambda ()
@@ -88,14 +93,22 @@
 		      (commit))))))))
     this-operation))
 
-(define (make-read-operation try-fn port)
+(define (schedule-task-when-fd-readable/exclusive sched fd task)
+  (schedule-task-when-fd-readable sched fd task #f #t))
+
+(define* (make-read-operation try-fn port #:key exclusive?)
   "Make an operation that tries TRY-FN, and when TRY-FN fails, blocks until
 the input port PORT is readable.  TRY-FN is a thunk that either returns #false,
 indicating failure, or a thunk, whose return values are the result of the
-operation."
+operation.  If EXCLUSIVE?, only one of the schedulers waiting exclusively
+on PORT is woken when it becomes readable, where supported."
   (unless (input-port? port)
     (error "refusing to wait forever for input on non-input port"))
-  (make-wait-operation try-fn schedule-task-when-fd-readable port
+  (make-wait-operation try-fn
+		       (if exclusive?
+			   schedule-task-when-fd-readable/exclusive
+			   schedule-task-when-fd-readable)
+		       port
 		       port-read-wait-fd))
 
 (define (make-write-operation try-fn port)
@@ -108,9 +121,73 @@ of the operation."
   (make-wait-operation try-fn schedule-task-when-fd-writable port
 		       port-write-wait-fd))
 
-(define (wait-until-port-readable-operation port)
-  "Make an operation that will succeed when PORT is readable."
-  (make-read-operation (try-ready readable? port) port))
+(define (make-fd-wait-operation try-fn schedule-when-ready)
+  "Make an operation that tries TRY-FN, and when TRY-FN fails, calls
+SCHEDULE-WHEN-READY with a scheduler and a task, which should arrange
+for the scheduler to run the task when TRY-FN might succeed, for
+example with schedule-task-when-fd-readable.  The task then claims the
+operation and tries TRY-FN again, until it succeeds.  If TRY-FN raises
+an exception when it is tried again, performing the operation raises
+it in the fiber."
+  (make-base-operation
+   #f
+   try-fn
+   (lambda (flag sched resume)
+     (define (retry)
+       ;; Claim the operation before trying again, so that whatever
+       ;; TRY-FN does, such as reading from FD, only happens if this
+       ;; operation is the one that succeeds.
+       (match (atomic-box-compare-and-swap! flag 'W 'C)
+	 ('W
+	  ;; This runs in the scheduler, not in the fiber, so an error
+	  ;; from TRY-FN, such as ECONNRESET, must not escape: that
+	  ;; would leave the operation claimed forever.  Instead, end
+	  ;; the operation and raise the error again in the fiber.
+	  (match (catch #t
+		   try-fn
+		   (lambda (key . args)
+		     (lambda () (apply throw key args))))
+	    (#f
+	     (atomic-box-set! flag 'W)
+	     (schedule-when-ready (current-scheduler) retry))
+	    (thunk
+	     (atomic-box-set! flag 'S)
+	     (resume thunk))))
+	 ('C (retry))
+	 ('S #f)))
+     (if sched
+	 (schedule-when-ready sched retry)
+	 (schedule-task
+	  (poll-sched)
+	  (lambda ()
+	    (schedule-when-ready (current-scheduler) retry)))))))
+
+(define* (make-fd-read-operation try-fn fd #:key exclusive?)
+  "Make an operation that tries TRY-FN, and when TRY-FN fails, tries it
+again whenever the file descriptor FD becomes readable, until it
+succeeds.  TRY-FN is a thunk that either returns #false, indicating
+failure, or a thunk, whose return values are the result of the
+operation.  Unlike with make-read-operation, TRY-FN is only called
+again once the operation is claimed, so it may consume input.
+EXCLUSIVE? is as for make-read-operation."
+  (make-fd-wait-operation
+   try-fn
+   (lambda (sched task)
+     (schedule-task-when-fd-readable sched fd task #f exclusive?))))
+
+(define (make-fd-write-operation try-fn fd)
+  "Like make-fd-read-operation, but tries TRY-FN again whenever the
+file descriptor FD becomes writable."
+  (make-fd-wait-operation
+   try-fn
+   (lambda (sched task)
+     (schedule-task-when-fd-writable sched fd task))))
+
+(define* (wait-until-port-readable-operation port #:key exclusive?)
+  "Make an operation that will succeed when PORT is readable.
+EXCLUSIVE? is as for make-read-operation."
+  (make-read-operation (try-ready readable? port) port
+		       #:exclusive? exclusive?))
 
 (define (wait-until-port-writable-operation port)
   "Make an operation that will succeed when PORT is writable."
@@ -159,7 +236,8 @@ the returned thunk) may not be changed while the thunk is being invoked."
       O_CLOEXEC ; doesn't exist on guile-2.2
       0))
 
-(define* (accept-operation port #:key (flags (logior O_CLOEXEC* O_NONBLOCK)))
+(define* (accept-operation port #:key (flags (logior O_CLOEXEC* O_NONBLOCK))
+                           exclusive?)
   "Like '(accept port flags)', but as an operation.  Unlike
 'accept', 'O_NONBLOCK' is included in the default flags,
 which makes the accepted port non-blocking and hence suitable for
@@ -172,10 +250,15 @@ rarely, ports are intended to be leaked to subprocesses, in which
 case you could remove this flag.
 
 Fibers doesn't emulate 'O_CLOEXEC' when unavailable, because it
-would not be entirely equivalent in case of parallelism."
+would not be entirely equivalent in case of parallelism.
+
+If 'EXCLUSIVE?' is true, each incoming connection wakes only one of
+the schedulers accepting on PORT with 'EXCLUSIVE?', where supported,
+rather than all of them."
   (define (try)
     (let ((new (accept port flags)))
       (and new (lambda () (values new)))))
   (make-read-operation
    (with-read-waiting-is-failure port try)
-   port))
+   port
+   #:exclusive? exclusive?))
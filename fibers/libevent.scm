@@ -31,11 +31,14 @@
               events-impl-destroy
               events-impl?
               events-impl-add!
+              events-impl-remove!
               events-impl-wake!
               events-impl-fd-finalizer
               events-impl-run
+              events-impl-now
 
-              EVENTS_IMPL_READ EVENTS_IMPL_WRITE EVENTS_IMPL_CLOSED_OR_ERROR))
+              EVENTS_IMPL_READ EVENTS_IMPL_WRITE EVENTS_IMPL_CLOSED_OR_ERROR
+              EVENTS_IMPL_EXCLUSIVE))
 
 (dynamic-call "init_fibers_libevt"
               (dynamic-link (extension-library "fibers-libevent")))
@@ -148,8 +151,9 @@
   (define (expiry->timeout expiry)
     (cond
      ((not expiry) -1)
+     ((eqv? expiry 0) 0)
      (else
-      (let ((now (get-internal-real-time)))
+      (let ((now (primitive-monotonic-time)))
         (cond
          ((< expiry now) 0)
          (else (- expiry now)))))))
@@ -178,6 +182,15 @@
 
 (define events-impl-add! libevt-add!)
 
+(define (events-impl-remove! impl fd)
+  ;; Does nothing if FD isn't registered.  If deleting the event fails,
+  ;; for example because FD was closed in the meantime, forget it
+  ;; anyway.
+  (catch 'misc-error
+    (lambda () (libevt-remove! impl fd))
+    (lambda _
+      (hashv-remove! (libevt-added impl) fd))))
+
 (define events-impl-wake! libevt-wake!)
 
 (define (events-impl-fd-finalizer impl fd-waiters)
@@ -194,3 +207,5 @@
     (set-car! fd-waiters #f)))
 
 (define events-impl-run libevt)
+
+(define events-impl-now primitive-monotonic-time)
@@ -0,0 +1,145 @@
+;; Fiber-aware mutexes
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; A mutex whose lock is an operation, so that waiting for it suspends
+;;; the fiber instead of blocking the scheduler's kernel thread.
+;;;
+;;; The state of a mutex is a single atomic box: #f when unlocked, and
+;;; a deque of waiting operations when locked.  Locking an unlocked
+;;; mutex is one compare-and-swap.  Waiters queue up in FIFO order, and
+;;; unlocking hands the mutex directly to the first waiter that is
+;;; still interested, without unlocking it in between, so that woken
+;;; waiters never have to compete for it.  Like the rest of Fibers,
+;;; this avoids locks entirely.
+
+(define-module (fibers mutex)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 atomic)
+  #:use-module (ice-9 match)
+  #:use-module (fibers deque)
+  #:use-module (fibers operations)
+  #:use-module ((fibers scheduler) #:select (dynamic-wind*))
+  #:replace (make-mutex
+             mutex?
+             lock-mutex
+             unlock-mutex
+             with-mutex)
+  #:export (lock-operation
+            try-lock-mutex
+            call-with-mutex))
+
+(define-record-type <mutex>
+  (%make-mutex state)
+  mutex?
+  ;; atomic box of #f if unlocked, or a deque of flag+resume pairs
+  (state mutex-state))
+
+(set-record-type-printer!
+ <mutex>
+ (lambda (mutex port)
+   (format port "#<fibers mutex ~a>"
+           (if (atomic-box-ref (mutex-state mutex)) "locked" "unlocked"))))
+
+(define (make-mutex)
+  "Make a fresh, unlocked mutex."
+  (%make-mutex (make-atomic-box #f)))
+
+(define (try-lock! state)
+  (not (atomic-box-compare-and-swap! state #f (make-empty-deque))))
+
+(define (try-lock-mutex mutex)
+  "Lock @var{mutex} and return @code{#t} if it is unlocked, or return
+@code{#f} without waiting otherwise."
+  (try-lock! (mutex-state mutex)))
+
+(define (lock-operation mutex)
+  "Make an operation that succeeds with no values once it has locked
+@var{mutex}.  Fibers waiting for the same mutex get it in the order in
+which they started waiting."
+  (match mutex
+    (($ <mutex> state)
+     (define (try-fn) (and (try-lock! state) values))
+     (define (block-fn flag sched resume)
+       (define (claim-lock)
+         ;; The mutex was unlocked after try-fn; we locked it, but we
+         ;; only keep it if this operation is the one that succeeds.
+         (match (atomic-box-compare-and-swap! flag 'W 'S)
+           ('W (resume values))
+           ('C (claim-lock))
+           ('S (unlock-mutex mutex))))
+       (let retry ((waiters (atomic-box-ref state)))
+         (cond
+          (waiters
+           (let* ((waiters* (enqueue waiters (cons flag resume)))
+                  (prev (atomic-box-compare-and-swap! state waiters waiters*)))
+             (unless (eq? prev waiters)
+               (retry prev))))
+          (else
+           (match (atomic-box-compare-and-swap! state #f (make-empty-deque))
+             (#f (claim-lock))
+             (prev (retry prev))))))
+       (values))
+     (make-base-operation #f try-fn block-fn))))
+
+(define (lock-mutex mutex)
+  "Lock @var{mutex}, waiting until it is unlocked if needed."
+  (unless (try-lock! (mutex-state mutex))
+    (perform-operation (lock-operation mutex))))
+
+(define (unlock-mutex mutex)
+  "Unlock @var{mutex}.  If fibers or threads are waiting to lock it,
+hand it to the one that has been waiting the longest instead.  The
+mutex does not record its owner, so it is an error, but not detected,
+to unlock a mutex that another fiber locked."
+  (let ((state (mutex-state mutex)))
+    (let retry ((waiters (atomic-box-ref state)))
+      (unless waiters
+        (error "mutex not locked" mutex))
+      (call-with-values (lambda () (dequeue waiters))
+        (lambda (rest waiter)
+          (define (update! waiters*)
+            (eq? (atomic-box-compare-and-swap! state waiters waiters*)
+                 waiters))
+          (cond
+           ((not rest)
+            (unless (update! #f)
+              (retry (atomic-box-ref state))))
+           ((update! rest)
+            (match waiter
+              ((flag . resume)
+               (let hand-off ()
+                 (match (atomic-box-compare-and-swap! flag 'W 'S)
+                   ('W (resume values))
+                   ('C (hand-off))
+                   ;; This waiter's operation already succeeded some
+                   ;; other way, for example by timing out.  We still
+                   ;; hold the mutex, so pass it on to the next one.
+                   ('S (retry rest)))))))
+           (else
+            (retry (atomic-box-ref state)))))))))
+
+(define (call-with-mutex mutex thunk)
+  "Call @var{thunk} with @var{mutex} locked, and unlock it when
+@var{thunk} returns or exits non-locally."
+  (lock-mutex mutex)
+  (dynamic-wind* (lambda () #t)
+                 thunk
+                 (lambda () (unlock-mutex mutex))))
+
+(define-syntax-rule (with-mutex mutex body body* ...)
+  (call-with-mutex mutex (lambda () body body* ...)))
@@ -59,6 +59,7 @@
   #:export (wrap-operation
             choice-operation
             perform-operation
+            try-perform-operation
 
             make-base-operation))
 
@@ -81,6 +82,37 @@
   choice-op?
   (base-ops choice-op-base-ops))
 
+;; What a thread that is not running a scheduler uses to block until an
+;; operation completes.  The parker is cached per thread, so that
+;; blocking doesn't have to make a new mutex and condition variable
+;; each time.
+(define-record-type <parker>
+  (%make-parker mutex condvar thunk)
+  parker?
+  (mutex parker-mutex)
+  (condvar parker-condvar)
+  ;; thunk | #f
+  (thunk parker-thunk set-parker-thunk!))
+
+(define (make-parker)
+  (%make-parker (make-mutex) (make-condition-variable) #f))
+
+;; Holds the parker of the current thread, or #f if the parker is in
+;; use, for example if an async blocks on an operation while the
+;; thread is already blocked.
+(define current-parker (make-thread-local-fluid #f))
+
+(define (take-parker!)
+  (match (fluid-ref current-parker)
+    (#f (make-parker))
+    (parker
+     (fluid-set! current-parker #f)
+     parker)))
+
+(define (return-parker! parker)
+  (set-parker-thunk! parker #f)
+  (fluid-set! current-parker parker))
+
 (define (wrap-operation op f)
   "Given the operation @var{op}, return a new operation that, if and
 when it succeeds, will apply @var{f} to the values yielded by
@@ -121,6 +153,33 @@ succeeds, will succeed with one and only one of the sub-operations
     ((base-op) base-op)
     (base-ops (make-choice-operation (list->vector base-ops)))))
 
+(define-inlinable (complete thunk wrap-fn)
+  (if wrap-fn
+      (call-with-values thunk wrap-fn)
+      (thunk)))
+
+;; Run the try phase of OP: try its base operations, starting at a
+;; random one if OP is a choice.  If one of them syncs, tail-call
+;; SUCCEED with the resulting thunk and the base operation's wrap-fn.
+;; Otherwise, tail-call FAIL with no arguments.
+(define-inlinable (try-operation op succeed fail)
+  (match op
+    (($ <base-op> wrap-fn try-fn)
+     (match (try-fn)
+       (#f (fail))
+       (thunk (succeed thunk wrap-fn))))
+    (($ <choice-op> base-ops)
+     (let* ((count (vector-length base-ops))
+            (offset (random count)))
+       (let lp ((i 0))
+         (if (< i count)
+             (match (vector-ref base-ops (modulo (+ i offset) count))
+               (($ <base-op> wrap-fn try-fn)
+                (match (try-fn)
+                  (#f (lp (1+ i)))
+                  (thunk (succeed thunk wrap-fn)))))
+             (fail)))))))
+
 (define (perform-operation op)
   "Perform the operation @var{op} and return the resulting values.  If
 the operation cannot complete directly, block until it can complete."
@@ -151,57 +210,47 @@ the operation cannot complete directly, block until it can complete."
     ;; operation succeeds, to allow for communication between fibers
     ;; and foreign threads.
     (if (current-scheduler)
-        ((suspend-current-task
-          (lambda (sched k)
-            (define (resume thunk)
-              (schedule-task sched (lambda () (k thunk))))
-            (block sched resume))))
-        (let ((k #f)
-              (thread (current-thread))
-              (mutex (make-mutex))
-              (condvar (make-condition-variable)))
+        (let ((deadline (current-task-deadline)))
+          ((suspend-current-task
+            (lambda (sched k)
+              (define (resume thunk)
+                (schedule-task sched (lambda () (k thunk)) deadline))
+              (block sched resume)))))
+        (let* ((thread (current-thread))
+               (parker (take-parker!))
+               (mutex (parker-mutex parker))
+               (condvar (parker-condvar parker)))
           (define (resume thunk)
             (cond
              ((eq? (current-thread) thread)
-              (set! k thunk))
+              (set-parker-thunk! parker thunk))
              (else
               (call-with-blocked-asyncs
                (lambda ()
                  (lock-mutex mutex)
-                 (set! k thunk)
+                 (set-parker-thunk! parker thunk)
                  (signal-condition-variable condvar)
                  (unlock-mutex mutex))))))
           (lock-mutex mutex)
           (block #f resume)
           (let lp ()
-            (cond
-             (k
-              (unlock-mutex mutex)
-              (k))
-             (else
-              (wait-condition-variable condvar mutex)
-              (lp)))))))
+            (match (parker-thunk parker)
+              (#f
+               (wait-condition-variable condvar mutex)
+               (lp))
+              (k
+               (unlock-mutex mutex)
+               ;; The operation can't resume us again, so the parker
+               ;; is free for the next operation on this thread.
+               (return-parker! parker)
+               (k)))))))
 
   ;; First, try to sync on an op.  If no op syncs, block.
-  (match op
-    (($ <base-op> wrap-fn try-fn)
-     (match (try-fn)
-       (#f (suspend))
-       (thunk
-        (if wrap-fn
-            (call-with-values thunk wrap-fn)
-            (thunk)))))
-    (($ <choice-op> base-ops)
-     (let* ((count (vector-length base-ops))
-            (offset (random count)))
-       (let lp ((i 0))
-         (if (< i count)
-             (match (vector-ref base-ops (modulo (+ i offset) count))
-               (($ <base-op> wrap-fn try-fn)
-                (match (try-fn)
-                  (#f (lp (1+ i)))
-                  (thunk
-                   (if wrap-fn
-                       (call-with-values thunk wrap-fn)
-                       (thunk))))))
-             (suspend)))))))
+  (try-operation op complete suspend))
+
+(define* (try-perform-operation op #:optional (fail (lambda () #f)))
+  "Perform the operation @var{op} if it can complete directly, and
+return the resulting values.  Otherwise, return the values of calling
+@var{fail}, which defaults to returning @code{#f}.  Either way, never
+suspend or block, and leave no trace of @var{op} behind."
+  (try-operation op complete fail))
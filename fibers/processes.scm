@@ -0,0 +1,195 @@
+;; Child processes
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Spawning child processes and waiting for them to exit without
+;;; blocking the scheduler.  Where the system has pidfd_open, each
+;;; child gets a pidfd, which becomes readable when the child exits, so
+;;; waiting for a child is just waiting for a file descriptor.  On
+;;; other systems, waiting falls back to a blocking waitpid on the
+;;; blocking pool.
+
+(define-module (fibers processes)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 atomic)
+  #:use-module (ice-9 match)
+  #:use-module (ice-9 threads)
+  #:use-module (fibers blocking)
+  #:use-module (fibers conditions)
+  #:use-module (fibers io-primitives)
+  #:use-module (fibers io-wakeup)
+  #:use-module (fibers operations)
+  #:use-module ((fibers scheduler)
+                #:select (schedule-task-when-fd-readable))
+  #:export (spawn-process
+            process?
+            process-pid
+            process-input
+            process-output
+            process-error
+            process-exit-operation
+            wait-for-process))
+
+(define-record-type <process>
+  (make-process pid pidfd input output error mutex status exited)
+  process?
+  (pid process-pid)
+  ;; Port on the pidfd of the process, or #f.  Closed once reaped.
+  (pidfd process-pidfd)
+  ;; Our ends of the stdio pipes, or #f.
+  (input process-input)
+  (output process-output)
+  (error process-error)
+  ;; Serializes reaping the process.
+  (mutex process-mutex)
+  ;; atomic box of the waitpid status, or #f if not yet reaped
+  (status process-status-box)
+  ;; condition signalled once reaped
+  (exited process-exited))
+
+(set-record-type-printer!
+ <process>
+ (lambda (process port)
+   (format port "#<process ~a>" (process-pid process))))
+
+;; Guile 3.0.9 and later.
+(define %spawn
+  (and=> (module-variable the-scm-module 'spawn) variable-ref))
+
+(define (check-spawn!)
+  (unless %spawn
+    (error "spawn-process needs Guile 3.0.9 or later")))
+
+(define (make-stdio-pipe child-reads?)
+  "Return two values: the child's end and our end of a new pipe.  Our
+end is nonblocking and not inherited by other children."
+  (match (pipe)
+    ((in . out)
+     (let ((ours (if child-reads? out in)))
+       (fcntl ours F_SETFD FD_CLOEXEC)
+       (fcntl ours F_SETFL (logior O_NONBLOCK (fcntl ours F_GETFL)))
+       (if child-reads?
+           (values in out)
+           (values out in))))))
+
+(define (stdio-ports port child-reads?)
+  (if (eq? port 'pipe)
+      (make-stdio-pipe child-reads?)
+      (values port #f)))
+
+(define (pidfd-port pid)
+  (match (primitive-pidfd-open pid)
+    (#f #f)
+    (fd (fdopen fd "r"))))
+
+(define* (spawn-process program arguments #:key
+                        (input (current-input-port))
+                        (output (current-output-port))
+                        (error (current-error-port))
+                        (environment (environ))
+                        (search-path? #t))
+  "Start @var{program} with the argument list @var{arguments}, whose
+first element is the program name, and return a process object.
+@var{input}, @var{output} and @var{error} are the file ports to use as
+the standard streams of the child, or the symbol @code{pipe} to
+connect that stream to a new pipe, whose other end is available as
+@code{process-input}, @code{process-output} or @code{process-error}.
+These ends are nonblocking, so fibers suspend rather than block when
+using them."
+  (check-spawn!)
+  (call-with-values (lambda () (stdio-ports input #t))
+    (lambda (child-input our-input)
+      (call-with-values (lambda () (stdio-ports output #f))
+        (lambda (child-output our-output)
+          (call-with-values (lambda () (stdio-ports error #f))
+            (lambda (child-error our-error)
+              (define (close-child-ends!)
+                (for-each (lambda (child ours)
+                            (when ours (close-port child)))
+                          (list child-input child-output child-error)
+                          (list our-input our-output our-error)))
+              (let ((pid (with-throw-handler #t
+                           (lambda ()
+                             (%spawn program arguments
+                                     #:input child-input
+                                     #:output child-output
+                                     #:error child-error
+                                     #:environment environment
+                                     #:search-path? search-path?))
+                           (lambda _
+                             (close-child-ends!)
+                             (for-each (lambda (port)
+                                         (when port (close-port port)))
+                                       (list our-input our-output
+                                             our-error))))))
+                (close-child-ends!)
+                (make-process pid (pidfd-port pid)
+                              our-input our-output our-error
+                              (make-mutex) (make-atomic-box #f)
+                              (make-condition))))))))))
+
+(define (reap! process options)
+  "Call waitpid on @var{process} with @var{options}, and return its
+exit status, or @code{#f} if it has not exited yet.  Once reaped, the
+status is remembered, so that several fibers can wait for the same
+process.  The pidfd of the process is closed as soon as it is
+reaped."
+  (let ((box (process-status-box process)))
+    (or (atomic-box-ref box)
+        (with-mutex (process-mutex process)
+          (or (atomic-box-ref box)
+              (match (waitpid (process-pid process) options)
+                ((0 . _) #f)
+                ((_ . status)
+                 (atomic-box-set! box status)
+                 (let ((pidfd (process-pidfd process)))
+                   (when pidfd
+                     (close-port pidfd)))
+                 ;; Closing the pidfd drops the registrations of
+                 ;; fibers waiting on it elsewhere; wake them here.
+                 (signal-condition! (process-exited process))
+                 status)))))))
+
+(define (process-exit-operation process)
+  "Make an operation that succeeds with the @code{waitpid} status of
+@var{process} once it has exited.  Use @code{status:exit-val} and
+@code{status:term-sig} to decode the status."
+  (define box (process-status-box process))
+  (match (process-pidfd process)
+    (#f
+     (blocking-operation (lambda () (reap! process 0))))
+    (pidfd
+     (choice-operation
+      (wrap-operation (wait-operation (process-exited process))
+                      (lambda () (atomic-box-ref box)))
+      (make-fd-wait-operation
+       (lambda ()
+         (let ((status (reap! process WNOHANG)))
+           (and status (lambda () status))))
+       (lambda (sched task)
+         ;; Once reaped, the pidfd is closed and its fd may be reused,
+         ;; so only register it before then; the exited condition
+         ;; covers the rest.
+         (with-mutex (process-mutex process)
+           (unless (atomic-box-ref box)
+             (schedule-task-when-fd-readable sched (fileno pidfd)
+                                             task)))))))))
+
+(define (wait-for-process process)
+  "Wait until @var{process} exits, and return its @code{waitpid}
+status."
+  (perform-operation (process-exit-operation process)))
@@ -0,0 +1,167 @@
+;; Reader-writer locks
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; A lock that any number of readers can hold at the same time, or a
+;;; single writer.
+;;;
+;;; Readers count themselves in one of several counters, picked by
+;;; kernel thread, so that readers on different schedulers don't
+;;; contend on the same atomic box.  A reader increments its counter and
+;;; then checks whether a writer is pending; if not, it holds the lock.
+;;; A writer first marks itself pending, then waits until the sum of the
+;;; counters drops to zero.  Because the reader increments before it
+;;; checks, and the writer marks before it sums, either the writer sees
+;;; the reader or the reader sees the writer.  The last reader to leave
+;;; while a writer is pending wakes it up.
+;;;
+;;; A reader may leave on a different kernel thread than the one it
+;;; entered on, so individual counters can go negative; only their sum
+;;; means anything.
+;;;
+;;; The lock prefers writers: new readers back off as soon as a writer
+;;; is pending, so that a steady stream of readers can't starve updates.
+;;; Writers take turns through a (fibers mutex).
+
+(define-module (fibers rwlock)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 atomic)
+  #:use-module (ice-9 match)
+  #:use-module ((ice-9 threads) #:select (current-processor-count))
+  #:use-module (fibers conditions)
+  #:use-module (fibers mutex)
+  #:use-module ((fibers scheduler) #:select (dynamic-wind*))
+  #:export (make-rwlock
+            rwlock?
+            read-lock!
+            read-unlock!
+            write-lock!
+            write-unlock!
+            call-with-read-lock
+            call-with-write-lock
+            with-read-lock
+            with-write-lock))
+
+(define-record-type <rwlock>
+  (%make-rwlock readers writer writer-mutex)
+  rwlock?
+  ;; vector of atomic boxes of integer
+  (readers rwlock-readers)
+  ;; atomic box of #f, or a pair of the conditions for "readers
+  ;; drained" and "writer done" if a writer is pending or active
+  (writer rwlock-writer)
+  ;; mutex held by the pending or active writer
+  (writer-mutex rwlock-writer-mutex))
+
+(set-record-type-printer!
+ <rwlock>
+ (lambda (rwlock port)
+   (format port "#<rwlock ~a>"
+           (if (atomic-box-ref (rwlock-writer rwlock))
+               "write-locked"
+               (format #f "~a readers" (reader-count rwlock))))))
+
+(define* (make-rwlock #:key (stripes (current-processor-count)))
+  "Make a fresh, unlocked reader-writer lock.  Readers are counted in
+@var{stripes} separate counters."
+  (%make-rwlock (let ((readers (make-vector stripes #f)))
+                  (let lp ((i 0))
+                    (when (< i stripes)
+                      (vector-set! readers i (make-atomic-box 0))
+                      (lp (1+ i))))
+                  readers)
+                (make-atomic-box #f)
+                (make-mutex)))
+
+(define (reader-stripe rwlock)
+  (let ((readers (rwlock-readers rwlock)))
+    (vector-ref readers (hashq (current-thread) (vector-length readers)))))
+
+(define (add! box n)
+  (let lp ((x (atomic-box-ref box)))
+    (let ((prev (atomic-box-compare-and-swap! box x (+ x n))))
+      (unless (eqv? prev x)
+        (lp prev)))))
+
+(define (reader-count rwlock)
+  (let ((readers (rwlock-readers rwlock)))
+    (let lp ((i 0) (sum 0))
+      (if (< i (vector-length readers))
+          (lp (1+ i) (+ sum (atomic-box-ref (vector-ref readers i))))
+          sum))))
+
+(define (read-unlock! rwlock)
+  "Release a read lock on @var{rwlock}."
+  (add! (reader-stripe rwlock) -1)
+  (match (atomic-box-ref (rwlock-writer rwlock))
+    (#f #t)
+    ((drained . done)
+     (when (zero? (reader-count rwlock))
+       (signal-condition! drained)))))
+
+(define (read-lock! rwlock)
+  "Take a read lock on @var{rwlock}, waiting while a writer holds or
+waits for it."
+  (let retry ()
+    (add! (reader-stripe rwlock) 1)
+    (match (atomic-box-ref (rwlock-writer rwlock))
+      (#f #t)
+      ((drained . done)
+       ;; Back off to let the writer in, then try again.
+       (read-unlock! rwlock)
+       (wait done)
+       (retry)))))
+
+(define (write-lock! rwlock)
+  "Take the write lock on @var{rwlock}, waiting until no other writer
+and no reader holds it.  Readers that arrive while the writer waits
+wait for it."
+  (lock-mutex (rwlock-writer-mutex rwlock))
+  (let ((drained (make-condition)))
+    (atomic-box-set! (rwlock-writer rwlock) (cons drained (make-condition)))
+    (unless (zero? (reader-count rwlock))
+      (wait drained))))
+
+(define (write-unlock! rwlock)
+  "Release the write lock on @var{rwlock}."
+  (match (atomic-box-swap! (rwlock-writer rwlock) #f)
+    (#f (error "rwlock not write-locked" rwlock))
+    ((drained . done)
+     (signal-condition! done)
+     (unlock-mutex (rwlock-writer-mutex rwlock)))))
+
+(define (call-with-read-lock rwlock thunk)
+  "Call @var{thunk} holding a read lock on @var{rwlock}, and release it
+when @var{thunk} returns or exits non-locally."
+  (read-lock! rwlock)
+  (dynamic-wind* (lambda () #t)
+                 thunk
+                 (lambda () (read-unlock! rwlock))))
+
+(define (call-with-write-lock rwlock thunk)
+  "Call @var{thunk} holding the write lock on @var{rwlock}, and release
+it when @var{thunk} returns or exits non-locally."
+  (write-lock! rwlock)
+  (dynamic-wind* (lambda () #t)
+                 thunk
+                 (lambda () (write-unlock! rwlock))))
+
+(define-syntax-rule (with-read-lock rwlock body body* ...)
+  (call-with-read-lock rwlock (lambda () body body* ...)))
+
+(define-syntax-rule (with-write-lock rwlock body body* ...)
+  (call-with-write-lock rwlock (lambda () body body* ...)))
@@ -21,6 +21,7 @@
   #:use-module (srfi srfi-9)
   #:use-module (srfi srfi-9 gnu)
   #:use-module (fibers events-impl)
+  #:use-module (fibers psq)
   #:use-module (fibers stack)
   #:use-module (fibers timer-wheel)
   #:use-module (ice-9 atomic)
@@ -35,6 +36,8 @@
             (scheduler-kernel-thread/public . scheduler-kernel-thread)
             scheduler-remote-peers
             scheduler-work-pending?
+            scheduler-now
+            scheduler-deadline-ordered?
             choose-parallel-scheduler
             run-scheduler
             destroy-scheduler
@@ -43,7 +46,10 @@
             schedule-task-when-fd-readable
             schedule-task-when-fd-writable
             schedule-task-at-time
+            unschedule-task-when-fd-active
+            unschedule-task-at-time
 
+            current-task-deadline
             rewinding-for-scheduling?
             suspend-current-task
             yield-current-task
@@ -53,7 +59,8 @@
 (define-record-type <scheduler>
   (%make-scheduler events-impl runcount-box prompt-tag
                    next-runqueue current-runqueue
-                   fd-waiters timers kernel-thread
+                   deadline-ordered? deadline-queue deadline-seq
+                   fd-waiters timers now kernel-thread
                    remote-peers choose-parallel-scheduler)
   scheduler?
   (events-impl scheduler-events-impl)
@@ -64,10 +71,19 @@
   (next-runqueue scheduler-next-runqueue)
   ;; atomic stack of tasks to run this turn
   (current-runqueue scheduler-current-runqueue)
+  ;; bool
+  (deadline-ordered? scheduler-deadline-ordered?)
+  ;; psq of (seq . task) -> (deadline . seq), holding the tasks to run
+  ;; this turn if deadline-ordered?, otherwise #f
+  (deadline-queue scheduler-deadline-queue set-scheduler-deadline-queue!)
+  ;; uint, tie-breaker for tasks with the same deadline
+  (deadline-seq scheduler-deadline-seq set-scheduler-deadline-seq!)
   ;; fd -> (total-events (events . task) ...)
   (fd-waiters scheduler-fd-waiters)
   ;; timer wheel of expiry -> task
   (timers scheduler-timers)
+  ;; time at the start of the current turn, in internal time units
+  (now %scheduler-now set-scheduler-now!)
   ;; atomic parameter of thread
   (kernel-thread scheduler-kernel-thread)
   ;; list of sched
@@ -119,25 +135,50 @@
                            (if (= idx (vector-length items)) 0 idx)))
                item)))))))
 
+(define (deadline-priority<? a b)
+  (match a
+    ((deadline-a . seq-a)
+     (match b
+       ((deadline-b . seq-b)
+        (or (< deadline-a deadline-b)
+            (and (= deadline-a deadline-b)
+                 (< seq-a seq-b))))))))
+
+(define (make-deadline-queue)
+  (make-psq (lambda (a b) (< (car a) (car b)))
+            deadline-priority<?))
+
 (define* (make-scheduler #:key parallelism
-                         (prompt-tag (make-prompt-tag "fibers")))
-  "Make a new scheduler in which to run fibers."
+                         (prompt-tag (make-prompt-tag "fibers"))
+                         (deadline-ordered? #f))
+  "Make a new scheduler in which to run fibers.  If
+@var{deadline-ordered?} is true, run the tasks of each turn in order of
+their deadline instead of in the order in which they were scheduled.
+Tasks are only ordered within a turn, and other schedulers can't steal
+work from a deadline-ordered scheduler."
   (let ((events-impl (events-impl-create))
         (runcount-box (make-atomic-box 0))
         (next-runqueue (make-empty-stack))
         (current-runqueue (make-empty-stack))
         (fd-waiters (make-hash-table))
-        (timers (make-timer-wheel))
+        (now (events-impl-now))
         (kernel-thread (make-atomic-parameter #f)))
-    (let* ((sched (%make-scheduler events-impl runcount-box prompt-tag
+    (let* ((timers (make-timer-wheel #:now now))
+           (sched (%make-scheduler events-impl runcount-box prompt-tag
                                    next-runqueue current-runqueue
-                                   fd-waiters timers kernel-thread
+                                   deadline-ordered?
+                                   (and deadline-ordered?
+                                        (make-deadline-queue))
+                                   0
+                                   fd-waiters timers now kernel-thread
                                    #f #f))
            (all-scheds
             (cons sched
                   (if parallelism
                       (map (lambda (_)
-                             (make-scheduler #:prompt-tag prompt-tag))
+                             (make-scheduler
+                              #:prompt-tag prompt-tag
+                              #:deadline-ordered? deadline-ordered?))
                            (iota (1- parallelism)))
                       '()))))
       (for-each
@@ -177,20 +218,45 @@ it was started, modulo 2@sup{32}."
 @code{#f} if @var{sched} is not running."
   ((scheduler-kernel-thread sched)))
 
+(define* (scheduler-now #:optional (sched (current-scheduler)))
+  "Return the time at which the current turn of @var{sched} started,
+in internal time units, as measured by the monotonic clock used for
+timers.  If @var{sched} is @code{#f}, as it is when called outside of
+a scheduler, read the clock instead."
+  (if sched
+      (%scheduler-now sched)
+      (events-impl-now)))
+
 (define (choose-parallel-scheduler sched)
   ((scheduler-choose-parallel-scheduler sched)))
 
 (define-inlinable (schedule-task/no-wakeup sched task)
   (stack-push! (scheduler-next-runqueue sched) task))
 
-(define (schedule-task sched task)
+;; Effectively a per-fiber variable, like rewinding-for-scheduling?.
+;; Holds the deadline of the current fiber, in internal time units, or
+;; #f if it has none.
+(define current-task-deadline
+  (make-parameter #f))
+
+(define-inlinable (deadline-task sched task deadline)
+  ;; Tasks on the next runqueue of a deadline-ordered scheduler may be
+  ;; tagged with their deadline.  Don't bother for other schedulers.
+  (if (and deadline (scheduler-deadline-ordered? sched))
+      (cons deadline task)
+      task))
+
+(define* (schedule-task sched task #:optional deadline)
   "Add the task @var{task} to the run queue of the scheduler
 @var{sched}.  On the next turn, @var{sched} will invoke @var{task}
-with no arguments.
+with no arguments.  If @var{sched} is deadline-ordered, @var{task}
+will be run before the tasks of that turn that have a later
+@var{deadline}; tasks without a deadline are due at the start of the
+turn.
 
 This function is thread-safe even if @var{sched} is running on a
 remote kernel thread."
-  (schedule-task/no-wakeup sched task)
+  (schedule-task/no-wakeup sched (deadline-task sched task deadline))
   (unless (eq? ((scheduler-kernel-thread sched)) (current-thread))
     (events-impl-wake! (scheduler-events-impl sched)))
   (values))
@@ -202,7 +268,10 @@ remote kernel thread."
      ;; First, clear the active status, as the EPOLLONESHOT has
      ;; deactivated our entry in the epoll set.  Set the car to 0, not #f, so
      ;; that 'schedule-tasks-for-active-fd' doesn't end up re-adding a
-     ;; finalizer on FD.
+     ;; finalizer on FD.  Exclusive registrations are not one-shot, so
+     ;; remove them explicitly.
+     (unless (zero? (logand active-events EVENTS_IMPL_EXCLUSIVE))
+       (events-impl-remove! (scheduler-events-impl sched) fd))
      (set-car! events+waiters 0)
      (set-cdr! events+waiters '())
      (unless (zero? (logand revents EVENTS_IMPL_CLOSED_OR_ERROR))
@@ -228,7 +297,7 @@ in the order they were added to the timer, not the order of their times."
   (define (schedule-on-current! task)
     ;(pk 'schedule! (current-scheduler) task)
     (schedule-task/no-wakeup (current-scheduler) task))
-  (timer-wheel-advance! (scheduler-timers sched) (get-internal-real-time)
+  (timer-wheel-advance! (scheduler-timers sched) (%scheduler-now sched)
                         schedule-on-current!))
 
 (define (schedule-tasks-for-next-turn sched)
@@ -254,6 +323,9 @@ in the order they were added to the timer, not the order of their times."
                               (schedule-tasks-for-active-fd fd revents sched)
                               sched)
                    #:seed sched)
+  ;; Read the clock once per turn; timers and operations that run
+  ;; during this turn use this cached value.
+  (set-scheduler-now! sched (events-impl-now))
   (schedule-tasks-for-expired-timers sched))
 
 (define (work-stealer sched)
@@ -271,7 +343,42 @@ stolen."
 any pending timeouts."
   (not (and (not (timer-wheel-next-entry-time (scheduler-timers sched)))
             (stack-empty? (scheduler-current-runqueue sched))
-            (stack-empty? (scheduler-next-runqueue sched)))))
+            (stack-empty? (scheduler-next-runqueue sched))
+            (match (scheduler-deadline-queue sched)
+              (#f #t)
+              (q (psq-empty? q))))))
+
+(define (enqueue-tasks-by-deadline! sched tasks)
+  "Add @var{tasks}, taken from the next runqueue of @var{sched}, to its
+deadline queue.  Tasks without a deadline are due now."
+  (let ((now (%scheduler-now sched)))
+    (let lp ((tasks tasks)
+             (q (scheduler-deadline-queue sched))
+             (seq (scheduler-deadline-seq sched)))
+      (match tasks
+        (()
+         (set-scheduler-deadline-queue! sched q)
+         (set-scheduler-deadline-seq! sched seq))
+        ((task . tasks)
+         (match task
+           ((deadline . task)
+            (lp tasks (psq-set q (cons seq task) (cons deadline seq))
+                (1+ seq)))
+           (task
+            (lp tasks (psq-set q (cons seq task) (cons now seq))
+                (1+ seq)))))))))
+
+(define (pop-task-by-deadline! sched)
+  "Remove the task with the earliest deadline from the deadline queue
+of @var{sched} and return it, or return @code{#f} if the queue is
+empty."
+  (let ((q (scheduler-deadline-queue sched)))
+    (and (not (psq-empty? q))
+         (call-with-values (lambda () (psq-pop q))
+           (lambda (key q)
+             (set-scheduler-deadline-queue! sched q)
+             (match key
+               ((seq . task) task)))))))
 
 ;; Effectively a per-fiber variable, because of how the dynamic state
 ;; is set up in fibers.scm.
@@ -310,7 +417,9 @@ value.  Return zero values."
         (lambda (k after-suspend)
           (after-suspend sched k))))
     (define (next-task)
-      (match (stack-pop! cur #f)
+      (match (if (scheduler-deadline-ordered? sched)
+                 (pop-task-by-deadline! sched)
+                 (stack-pop! cur #f))
         (#f
          (when (stack-empty? next)
            ;; Both current and next runqueues are empty; steal a
@@ -327,7 +436,9 @@ value.  Return zero values."
     (define (next-turn)
       (unless (finished?)
         (schedule-tasks-for-next-turn sched)
-        (stack-push-list! cur (reverse (stack-pop-all! next)))
+        (if (scheduler-deadline-ordered? sched)
+            (enqueue-tasks-by-deadline! sched (reverse (stack-pop-all! next)))
+            (stack-push-list! cur (reverse (stack-pop-all! next))))
         (next-task)))
     (define (run-scheduler/error-handling)
       (catch #t
@@ -348,11 +459,85 @@ value.  Return zero values."
 
 (define (destroy-scheduler sched)
   "Release any resources associated with @var{sched}."
+  ;; Don't keep SCHED alive as the owner of its fds.
+  (hash-for-each (lambda (fd fd-waiters)
+                   (let ((box (fd-owner-box fd)))
+                     (when box
+                       (atomic-box-compare-and-swap! box sched #f))))
+                 (scheduler-fd-waiters sched))
   (events-impl-destroy (scheduler-events-impl sched)))
 
+;; Each fd is registered in the events backend of the scheduler that
+;; last armed it, its owner.  When a fiber migrates to another scheduler
+;; and waits on the same fd there, the old owner's registration becomes
+;; stale.  The owners are kept in a vector indexed by fd, of atomic
+;; boxes, so that re-arming an fd on its owner only reads an atomic box;
+;; only a move to another scheduler writes to it.  The vector only
+;; grows, and growing copies the boxes themselves.
+(define fd-owners (make-atomic-box (vector)))
+
+(define (fd-owner-box fd)
+  (let ((owners (atomic-box-ref fd-owners)))
+    (and (< fd (vector-length owners))
+         (vector-ref owners fd))))
+
+(define (ensure-fd-owner-box! fd)
+  (or (fd-owner-box fd)
+      (let* ((owners (atomic-box-ref fd-owners))
+             (n (vector-length owners))
+             (owners* (make-vector (max (1+ fd) (* 2 n)) #f)))
+        (vector-move-left! owners 0 n owners* 0)
+        (let lp ((i n))
+          (when (< i (vector-length owners*))
+            (vector-set! owners* i (make-atomic-box #f))
+            (lp (1+ i))))
+        (atomic-box-compare-and-swap! fd-owners owners owners*)
+        (ensure-fd-owner-box! fd))))
+
+(define (release-stale-fd! sched fd)
+  "Arrange for @var{sched}, which no longer owns @var{fd}, to remove
+its registration for @var{fd} if it has no waiters for it, so that the
+fd doesn't linger in its events backend."
+  (define (release!)
+    (if (eq? (current-scheduler) sched)
+        (match (hashv-ref (scheduler-fd-waiters sched) fd)
+          ((0)
+           ;; Keep the entry and its fdes finalizer, so that waiting on
+           ;; FD here again just adds it back.
+           (events-impl-remove! (scheduler-events-impl sched) fd))
+          (_ #f))
+        ;; Stolen by another scheduler; only SCHED may touch its
+        ;; fd-waiters.
+        (schedule-task sched release!)))
+  ;; A scheduler that isn't running may already have been destroyed.
+  (when ((scheduler-kernel-thread sched))
+    (schedule-task sched release!)))
+
+(define (note-fd-armed! sched fd events)
+  ;; Several schedulers waiting exclusively on an fd share it on
+  ;; purpose, so don't make them take turns releasing it.
+  (when (zero? (logand events EVENTS_IMPL_EXCLUSIVE))
+    (let ((box (ensure-fd-owner-box! fd)))
+      (unless (eq? (atomic-box-ref box) sched)
+        (let ((owner (atomic-box-swap! box sched)))
+          (when (and owner (not (eq? owner sched)))
+            (release-stale-fd! owner fd)))))))
+
+(define (combine-fd-events active-events events)
+  "Return the events to register for an fd that is registered for
+@var{active-events}, when a task starts waiting for @var{events}.  A
+registration stays exclusive only if all of its waiters asked for it."
+  (let ((combined (logior active-events events)))
+    (if (or (zero? active-events)
+            (not (zero? (logand active-events events EVENTS_IMPL_EXCLUSIVE))))
+        combined
+        (logand combined (lognot EVENTS_IMPL_EXCLUSIVE)))))
+
 (define (schedule-task-when-fd-active sched fd events task)
   "Arrange for @var{sched} to schedule @var{task} when the file descriptor
-@var{fd} becomes active with any of the given @var{events}."
+@var{fd} becomes active with any of the given @var{events}.  If
+@var{events} includes @code{EVENTS_IMPL_EXCLUSIVE}, other schedulers
+waiting exclusively on @var{fd} may be woken instead of @var{sched}."
   (let ((fd-waiters (hashv-ref (scheduler-fd-waiters sched) fd)))
     (match fd-waiters
       ((or #f (#f))                               ;FD is new or was finalized
@@ -360,30 +545,98 @@ value.  Return zero values."
          (hashv-set! (scheduler-fd-waiters sched) fd fd-waiters)
          (add-fdes-finalizer! fd (events-impl-fd-finalizer (scheduler-events-impl sched)
                                                            fd-waiters))
+         (note-fd-armed! sched fd events)
          (events-impl-add! (scheduler-events-impl sched) fd events)))
       ((active-events . waiters)
        (set-cdr! fd-waiters (acons events task waiters))
-       (unless (= (logand events active-events) events)
-         (let ((active-events (logior events active-events)))
-           (set-car! fd-waiters active-events)
-           (events-impl-add! (scheduler-events-impl sched) fd active-events)))))))
-
-(define (schedule-task-when-fd-readable sched fd task)
+       (let ((events (combine-fd-events active-events events)))
+         (unless (= events active-events)
+           ;; Exclusive registrations can't be modified, only removed
+           ;; and added again.
+           (unless (zero? (logand active-events EVENTS_IMPL_EXCLUSIVE))
+             (events-impl-remove! (scheduler-events-impl sched) fd))
+           (when (zero? active-events)
+             (note-fd-armed! sched fd events))
+           (set-car! fd-waiters events)
+           (events-impl-add! (scheduler-events-impl sched) fd events)))))))
+
+(define* (schedule-task-when-fd-readable sched fd task #:optional deadline
+                                         exclusive?)
   "Arrange to schedule @var{task} on @var{sched} when the file
-descriptor @var{fd} becomes readable."
-  (schedule-task-when-fd-active sched fd EVENTS_IMPL_READ task))
-
-(define (schedule-task-when-fd-writable sched fd task)
+descriptor @var{fd} becomes readable.  @var{deadline} is as for
+@code{schedule-task}.  If @var{exclusive?} is true and the events
+backend supports it, each event on @var{fd} wakes only one of the
+schedulers that wait on it exclusively, instead of all of them."
+  ;; The events backend drops whatever it can't combine with an
+  ;; exclusive wait, such as EPOLLRDHUP for epoll.
+  (schedule-task-when-fd-active sched fd
+                                (if exclusive?
+                                    (logior EVENTS_IMPL_READ
+                                            EVENTS_IMPL_EXCLUSIVE)
+                                    EVENTS_IMPL_READ)
+                                (deadline-task sched task deadline)))
+
+(define* (schedule-task-when-fd-writable sched fd task #:optional deadline)
   "Arrange to schedule @var{k} on @var{sched} when the file descriptor
-@var{fd} becomes writable."
-  (schedule-task-when-fd-active sched fd EVENTS_IMPL_WRITE task))
+@var{fd} becomes writable.  @var{deadline} is as for
+@code{schedule-task}."
+  (schedule-task-when-fd-active sched fd EVENTS_IMPL_WRITE
+                                (deadline-task sched task deadline)))
 
 (define (schedule-task-at-time sched expiry task)
-  "Arrange to schedule @var{task} when the absolute real time is
-greater than or equal to @var{expiry}, expressed in internal time
-units."
+  "Arrange to schedule @var{task} when the scheduler clock is greater
+than or equal to @var{expiry}, expressed in internal time units.  See @code{scheduler-now}.
+Return a timer that can be passed to @code{unschedule-task-at-time}."
   (timer-wheel-add! (scheduler-timers sched) expiry task))
 
+(define (call-on-scheduler sched thunk)
+  ;; The fd-waiters and timers of SCHED may only be touched by SCHED
+  ;; itself.  A task scheduled there may be stolen by a peer, in which
+  ;; case it sends itself back.
+  (let retry ()
+    (if (eq? (current-scheduler) sched)
+        (thunk)
+        ;; A scheduler that isn't running may already have been
+        ;; destroyed.
+        (when ((scheduler-kernel-thread sched))
+          (schedule-task sched retry)))))
+
+(define (unschedule-task-at-time sched timer)
+  "Cancel @var{timer}, as returned by @code{schedule-task-at-time} on
+@var{sched}, unless it has fired already.  This function is
+thread-safe; if called from another scheduler, the timer is cancelled
+on the next turn of @var{sched}."
+  (call-on-scheduler sched
+                     (lambda ()
+                       (timer-wheel-remove! (scheduler-timers sched) timer))))
+
+(define (unschedule-task-when-fd-active sched fd task)
+  "Stop waiting for @var{fd} to schedule @var{task} on @var{sched}, as
+arranged by @code{schedule-task-when-fd-readable} or
+@code{schedule-task-when-fd-writable}, unless it has been scheduled
+already.  If no other task waits for @var{fd}, remove it from the
+events backend.  Like @code{unschedule-task-at-time}, this function is
+thread-safe."
+  (define (for-task? waiter)
+    (match waiter
+      ((events . (? (lambda (t) (eq? t task)))) #t)
+      ((events deadline . (? (lambda (t) (eq? t task)))) #t)
+      (_ #f)))
+  (call-on-scheduler
+   sched
+   (lambda ()
+     (match (hashv-ref (scheduler-fd-waiters sched) fd)
+       ((and fd-waiters (active-events . waiters))
+        (let ((waiters* (filter (lambda (waiter) (not (for-task? waiter)))
+                                waiters)))
+          (set-cdr! fd-waiters waiters*)
+          (when (and (null? waiters*) (pair? waiters))
+            ;; Keep the entry and its fdes finalizer, as in
+            ;; release-stale-fd!.
+            (events-impl-remove! (scheduler-events-impl sched) fd)
+            (set-car! fd-waiters 0))))
+       (#f #f)))))
+
 ;; Shim for Guile 2.1.5.
 (unless (defined? 'suspendable-continuation?)
   (define! 'suspendable-continuation? (lambda (tag) #t)))
@@ -441,7 +694,12 @@ suspending if the current continuation isn't suspendable.  Returns
               ;; force this situation to happen.
               (when (and (not nested?) %nesting-test-1?)
                 (yield-current-task))
-              (abort-to-prompt tag schedule-task)
+              (match (current-task-deadline)
+                (#f (abort-to-prompt tag schedule-task))
+                (deadline
+                 (abort-to-prompt tag
+                                  (lambda (sched k)
+                                    (schedule-task sched k deadline)))))
               (when (and (not nested?) %nesting-test-2?)
                 (yield-current-task))
 	      (unless nested?
@@ -0,0 +1,186 @@
+;; Counting semaphores
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; A semaphore holds a number of permits.  Acquiring permits is an
+;;; operation, so that a fiber waiting for them suspends instead of
+;;; blocking its scheduler, and so that acquiring can be combined with
+;;; other operations, for example to time out.
+;;;
+;;; The whole state of a semaphore is one atomic box holding a pair of
+;;; the number of available permits and a deque of waiting operations.
+;;; When nobody is waiting, acquiring or releasing permits is a single
+;;; compare-and-swap.  Waiters are served in FIFO order: as long as
+;;; somebody is waiting, new acquirers queue up behind them even if
+;;; enough permits are available, and releasing permits hands them
+;;; directly to the waiters at the front of the queue.  Like the rest
+;;; of Fibers, this avoids locks entirely.
+
+(define-module (fibers semaphore)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 atomic)
+  #:use-module (ice-9 match)
+  #:use-module (fibers deque)
+  #:use-module (fibers operations)
+  #:use-module ((fibers scheduler) #:select (dynamic-wind*))
+  #:export (make-semaphore
+            semaphore?
+            semaphore-permits
+            acquire-operation
+            acquire!
+            try-acquire!
+            release!
+            call-with-semaphore))
+
+(define-record-type <semaphore>
+  (%make-semaphore state)
+  semaphore?
+  ;; atomic box of a pair of the number of available permits and a
+  ;; deque of flag+resume+count triples
+  (state semaphore-state))
+
+(set-record-type-printer!
+ <semaphore>
+ (lambda (sem port)
+   (match (atomic-box-ref (semaphore-state sem))
+     ((permits . waiters)
+      (format port "#<semaphore ~a permits>" permits)))))
+
+(define (check-count who k)
+  (unless (and (exact-integer? k) (positive? k))
+    (scm-error 'wrong-type-arg who
+               "Expected a positive exact integer: ~S" (list k) (list k))))
+
+(define (make-semaphore permits)
+  "Make a semaphore with @var{permits} available permits."
+  (unless (and (exact-integer? permits) (not (negative? permits)))
+    (scm-error 'wrong-type-arg "make-semaphore"
+               "Expected a non-negative exact integer: ~S"
+               (list permits) (list permits)))
+  (%make-semaphore (make-atomic-box (cons permits (make-empty-deque)))))
+
+(define (semaphore-permits sem)
+  "Return the number of permits currently available in @var{sem}."
+  (car (atomic-box-ref (semaphore-state sem))))
+
+(define (take-permits! state k)
+  (let retry ((s (atomic-box-ref state)))
+    (match s
+      ((permits . waiters)
+       (and (<= k permits)
+            (if (empty-deque? waiters)
+                (let ((prev (atomic-box-compare-and-swap!
+                             state s (cons (- permits k) waiters))))
+                  (or (eq? prev s)
+                      (retry prev)))
+                ;; The waiters may all have given up already; serve the
+                ;; queue, which drops them, and try again if it did.
+                (begin
+                  (give-permits! state 0)
+                  (let ((s* (atomic-box-ref state)))
+                    (and (not (eq? s* s))
+                         (retry s*))))))))))
+
+(define (give-permits! state k)
+  ;; Add K permits to STATE, then hand permits to the waiters at the
+  ;; front of the queue for as long as there are enough of them.  K may
+  ;; be zero, to serve waiters after a waiter was added.
+  (let retry ((k k))
+    (let ((s (atomic-box-ref state)))
+      (define (update! s*)
+        (eq? (atomic-box-compare-and-swap! state s s*) s))
+      (match s
+        ((permits . waiters)
+         (let ((permits (+ permits k)))
+           (call-with-values (lambda () (dequeue waiters))
+             (lambda (rest waiter)
+               (match waiter
+                 (#f
+                  (unless (or (zero? k) (update! (cons permits waiters)))
+                    (retry k)))
+                 ((flag resume . n)
+                  (cond
+                   ((eq? (atomic-box-ref flag) 'S)
+                    ;; This waiter's operation already succeeded some
+                    ;; other way, for example by timing out.  Drop it so
+                    ;; that it doesn't hold up the waiters behind it.
+                    (if (update! (cons permits rest))
+                        (retry 0)
+                        (retry k)))
+                   ((< permits n)
+                    (unless (or (zero? k) (update! (cons permits waiters)))
+                      (retry k)))
+                   ((update! (cons (- permits n) rest))
+                    (let hand-off ()
+                      (match (atomic-box-compare-and-swap! flag 'W 'S)
+                        ('W (resume values) (retry 0))
+                        ('C (hand-off))
+                        ;; Lost the race against another way for the
+                        ;; operation to succeed; take the permits back.
+                        ('S (retry n)))))
+                   (else
+                    (retry k)))))))))))))
+
+(define* (try-acquire! sem #:optional (k 1))
+  "Take @var{k} permits from @var{sem} and return @code{#t} if they are
+available and nobody is waiting for permits, or return @code{#f}
+without waiting otherwise."
+  (check-count "try-acquire!" k)
+  (take-permits! (semaphore-state sem) k))
+
+(define* (acquire-operation sem #:optional (k 1))
+  "Make an operation that succeeds with no values once it has taken
+@var{k} permits from @var{sem}.  Operations waiting on the same
+semaphore get their permits in the order in which they started
+waiting."
+  (check-count "acquire-operation" k)
+  (match sem
+    (($ <semaphore> state)
+     (define (try-fn) (and (take-permits! state k) values))
+     (define (block-fn flag sched resume)
+       (let retry ()
+         (match (atomic-box-ref state)
+           ((and s (permits . waiters))
+            (let ((s* (cons permits (enqueue waiters (cons* flag resume k)))))
+              (unless (eq? (atomic-box-compare-and-swap! state s s*) s)
+                (retry))))))
+       ;; Permits may have been released between the calls to try-fn
+       ;; and block-fn, in which case nobody would wake us up.  Serve
+       ;; the queue to resolve the race.
+       (give-permits! state 0)
+       (values))
+     (make-base-operation #f try-fn block-fn))))
+
+(define* (acquire! sem #:optional (k 1))
+  "Take @var{k} permits from @var{sem}, waiting until they are available
+if needed."
+  (unless (try-acquire! sem k)
+    (perform-operation (acquire-operation sem k))))
+
+(define* (release! sem #:optional (k 1))
+  "Return @var{k} permits to @var{sem}, waking fibers or threads that
+are waiting for them."
+  (check-count "release!" k)
+  (give-permits! (semaphore-state sem) k))
+
+(define* (call-with-semaphore sem thunk #:optional (k 1))
+  "Call @var{thunk} holding @var{k} permits from @var{sem}, and release
+them when @var{thunk} returns or exits non-locally."
+  (acquire! sem k)
+  (dynamic-wind* (lambda () #t)
+                 thunk
+                 (lambda () (release! sem k))))
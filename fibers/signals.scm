@@ -0,0 +1,68 @@
+;; Waiting for signals
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Signals as operations.  The first time a fiber waits for a signal,
+;;; a C-level handler is installed that writes a byte to a nonblocking
+;;; pipe whenever the signal arrives, on whatever thread it arrives.
+;;; Waiting for the signal is then waiting for the pipe to become
+;;; readable, like any other file descriptor, without going through
+;;; Guile's asyncs.
+;;;
+;;; Linux's signalfd would avoid the handler, but it only sees signals
+;;; that are blocked in every thread of the process, and Guile starts
+;;; threads of its own, such as the finalizer and signal delivery
+;;; threads, whose signal masks we don't control.
+
+(define-module (fibers signals)
+  #:use-module (rnrs bytevectors)
+  #:use-module (ice-9 threads)
+  #:use-module (fibers io-primitives)
+  #:use-module (fibers io-wakeup)
+  #:use-module (fibers operations)
+  #:export (signal-operation
+            wait-for-signal))
+
+;; Signal number -> read end of its pipe.
+(define signal-fds (make-hash-table))
+(define signal-fds-mutex (make-mutex))
+
+(define (signal-fd signum)
+  (with-mutex signal-fds-mutex
+    (or (hashv-ref signal-fds signum)
+        (let ((fd (primitive-signal-fd signum)))
+          (hashv-set! signal-fds signum fd)
+          fd))))
+
+(define (signal-operation signum)
+  "Make an operation that succeeds with @var{signum} when the signal
+@var{signum} arrives.  Each arrival of the signal makes one waiting
+operation succeed; arrivals while no one is waiting are remembered,
+although several of them may be coalesced into one.
+
+The first call for a given signal replaces any handler installed for it
+with @code{sigaction}, permanently."
+  (let ((fd (signal-fd signum))
+        (buf (make-bytevector 1)))
+    (make-fd-read-operation
+     (lambda ()
+       (and (primitive-fd-read fd buf 0 1)
+            (lambda () signum)))
+     fd)))
+
+(define (wait-for-signal signum)
+  "Wait until the signal @var{signum} arrives."
+  (perform-operation (signal-operation signum)))
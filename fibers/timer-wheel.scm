@@ -31,6 +31,7 @@
   #:use-module (ice-9 format)
   #:export (make-timer-wheel
             timer-wheel-add!
+            timer-wheel-remove!
             timer-wheel-next-entry-time
             timer-wheel-next-tick-start
             timer-wheel-next-tick-end
@@ -141,6 +142,24 @@
         (else
          (timer-wheel-add! (or outer (add-outer-wheel! wheel)) t obj)))))))
 
+(define (timer-wheel-remove! wheel entry)
+  "Remove @var{entry}, as returned by @code{timer-wheel-add!}, from
+@var{wheel}.  Do nothing if the entry has already fired or been
+removed."
+  (match entry
+    (($ <timer-entry> prev next)
+     (when next
+       (set-timer-entry-next! prev next)
+       (set-timer-entry-prev! next prev)
+       (set-timer-entry-prev! entry #f)
+       (set-timer-entry-next! entry #f)
+       ;; The entry may have been the next one to fire, in this wheel or
+       ;; in any of the outer ones.
+       (let lp ((wheel wheel))
+         (when wheel
+           (set-timer-wheel-next-entry-time! wheel 'unknown)
+           (lp (timer-wheel-outer wheel))))))))
+
 (define (timer-wheel-next-entry-time wheel)
   (define (slot-min-time head)
     (let lp ((entry (timer-entry-next head)) (min #f))
@@ -240,7 +259,12 @@
              (push-timer-entry! entry new-head)))))
       (advance-wheel! outer add-to-inner!))
 
-    (advance-wheel! wheel (lambda (entry t obj) (schedule! obj))))
+    (advance-wheel! wheel (lambda (entry t obj)
+                            ;; Mark the entry as fired, for
+                            ;; timer-wheel-remove!.
+                            (set-timer-entry-prev! entry #f)
+                            (set-timer-entry-next! entry #f)
+                            (schedule! obj))))
 
   (match wheel
     (($ <timer-wheel> time-base shift cur slots outer)
@@ -41,13 +41,32 @@
              (run-scheduler sched finished?)))
           sched)))))
 
-(define (timer-operation expiry)
+(define (coalesce-expiry expiry slack)
+  "Return a time between @var{expiry} and @var{expiry} plus
+@var{slack}, rounded up to a multiple of the largest power of two that
+is not greater than @var{slack}.  Timers with similar slack then tend
+to share the same expiry, so that one scheduler wakeup can serve all
+of them."
+  (if (positive? slack)
+      (let* ((granularity (ash 1 (1- (integer-length slack))))
+             (rem (modulo expiry granularity)))
+        (if (zero? rem)
+            expiry
+            (+ expiry (- granularity rem))))
+      expiry))
+
+(define* (timer-operation expiry #:key (slack 0))
   "Make an operation that will succeed when the current time is
 greater than or equal to @var{expiry}, expressed in internal time
-units.  The operation will succeed with no values."
+units as returned by @code{scheduler-now}.  The operation will succeed
+with no values.
+
+If @var{slack} is positive, the operation may be delayed by up to
+@var{slack} internal time units past @var{expiry}, which allows its
+wakeup to be coalesced with that of other timers."
   (make-base-operation #f
                        (lambda ()
-                         (and (< expiry (get-internal-real-time))
+                         (and (< expiry (scheduler-now))
                               values))
                        (lambda (flag sched resume)
                          (define (timer)
@@ -56,20 +75,28 @@ units.  The operation will succeed with no values."
                              ('C (timer))
                              ('S #f)))
                          (if sched
-                             (schedule-task-at-time sched expiry timer)
+                             (schedule-task-at-time
+                              sched (coalesce-expiry expiry slack) timer)
                              (schedule-task
                               (timer-sched)
                               (lambda ()
-                                (perform-operation (timer-operation expiry))
+                                (perform-operation
+                                 (timer-operation expiry #:slack slack))
                                 (timer)))))))
 
-(define (sleep-operation seconds)
+(define* (sleep-operation seconds #:key (slack 0))
   "Make an operation that will succeed with no values when
-@var{seconds} have elapsed."
-  (timer-operation
-   (+ (get-internal-real-time)
-      (inexact->exact
-       (round (* seconds internal-time-units-per-second))))))
+@var{seconds} have elapsed.  If @var{slack} is positive, the operation
+may complete up to @var{slack} seconds later than that, allowing its
+wakeup to be coalesced with that of other timers."
+  (define (seconds->internal-time seconds)
+    (inexact->exact (round (* seconds internal-time-units-per-second))))
+  ;; Count from a fresh clock reading rather than the start of the
+  ;; current turn, which may be long past, so that the sleep doesn't end
+  ;; early.  That's one clock read per sleep; timer-operation with an
+  ;; expiry based on scheduler-now avoids it.
+  (timer-operation (+ (scheduler-now #f) (seconds->internal-time seconds))
+                   #:slack (seconds->internal-time slack)))
 
 (define (sleep seconds)
   "Block the calling fiber until @var{seconds} have elapsed."
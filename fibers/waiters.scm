@@ -0,0 +1,68 @@
+;; Waiter stacks
+
+;;;; Copyright (C) 2017 Andy Wingo <wingo@pobox.com>
+;;;; Copyright (C) 2017 Christopher Allan Webber <cwebber@dustycloud.org>
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Internal helpers for primitives that keep a stack of flag+resume
+;;; waiters, such as (fibers conditions) and (fibers broadcast).
+
+(define-module (fibers waiters)
+  #:use-module (ice-9 atomic)
+  #:use-module (ice-9 match)
+  #:use-module (fibers stack)
+  #:use-module (fibers counter)
+  #:export (resume-waiter!
+            resume-waiters!
+            collect-garbage!))
+
+(define (resume-waiter! flag resume)
+  "Resume the waiter with @var{flag} by calling @var{resume} with
+@code{values}, unless its operation has already succeeded."
+  (match (atomic-box-compare-and-swap! flag 'W 'S)
+    ('W (resume values))
+    ('C (resume-waiter! flag resume))
+    ('S #f)))
+
+(define (resume-waiters! waiters)
+  "Pop all flag+resume pairs off the stack @var{waiters}, and resume
+them with @code{resume-waiter!}."
+  ;; Non-tail-recursion to resume waiters in the order they were added
+  ;; to the waiters stack.
+  (let lp ((waiters (stack-pop-all! waiters)))
+    (match waiters
+      (() #f)
+      (((flag . resume) . waiters)
+       (lp waiters)
+       (resume-waiter! flag resume)))))
+
+(define (collect-garbage! waiters gc-step)
+  "Every so often, as counted by the counter @var{gc-step}, prune the
+waiters that have already succeeded from the stack @var{waiters}."
+  ;; Decrement the garbage collection counter.
+  ;; If we've surpassed the number of steps until garbage collection,
+  ;; prune out waiters that have already succeeded.
+  ;;
+  ;; Note that it's possible that this number will go negative,
+  ;; but stack-filter! should handle this without errors (though
+  ;; possibly extra spin), and testing against zero rather than
+  ;; less than zero will prevent multiple threads from repeating
+  ;; this work.
+  (when (= (counter-decrement! gc-step) 0)
+    (stack-filter! waiters
+                   (match-lambda
+                     ((flag . _)
+                      (not (eq? (atomic-box-ref flag) 'S)))))
+    (counter-reset! gc-step)))
@@ -27,6 +27,8 @@
 (define-module (fibers web server)
   #:use-module (fibers)
   #:use-module (fibers conditions)
+  #:use-module (fibers fd-io)
+  #:use-module (fibers scheduler)
   #:use-module (rnrs bytevectors)
   #:use-module (ice-9 binary-ports)
   #:use-module (ice-9 textual-ports)
@@ -40,17 +42,31 @@
   #:export (run-server))
 
 (define (set-nonblocking! port)
-  (fcntl port F_SETFL (logior O_NONBLOCK (fcntl port F_GETFL)))
-  (setvbuf port 'block 1024))
+  (fcntl port F_SETFL (logior O_NONBLOCK (fcntl port F_GETFL))))
 
-(define (make-default-socket family addr port)
+(define* (make-default-socket family addr port #:key reuse-port?)
   (let ((sock (socket PF_INET SOCK_STREAM 0)))
     (setsockopt sock SOL_SOCKET SO_REUSEADDR 1)
+    (when reuse-port?
+      (unless (defined? 'SO_REUSEPORT)
+        (error "SO_REUSEPORT not supported on this system"))
+      (setsockopt sock SOL_SOCKET SO_REUSEPORT 1))
     (fcntl sock F_SETFD FD_CLOEXEC)
     (bind sock family addr port)
     (set-nonblocking! sock)
     sock))
 
+(define (make-reuse-port-socket sockaddr)
+  "Make another socket that listens on SOCKADDR, the address of an
+existing listening socket created with SO_REUSEPORT."
+  (let ((sock (socket (sockaddr:fam sockaddr) SOCK_STREAM 0)))
+    (setsockopt sock SOL_SOCKET SO_REUSEADDR 1)
+    (setsockopt sock SOL_SOCKET SO_REUSEPORT 1)
+    (fcntl sock F_SETFD FD_CLOEXEC)
+    (bind sock sockaddr)
+    (set-nonblocking! sock)
+    sock))
+
 (define (extend-response r k v . additional)
   (define (extend-alist alist k v)
     (let ((pair (assq k alist)))
@@ -160,6 +176,30 @@ on the procedure being called at any particular time."
       #:post-error (lambda _
                      (values (build-response #:code 500) #f))))))
 
+(define (write-response/body response body client)
+  "Write RESPONSE and BODY to the port CLIENT.  A bytevector body is sent
+along with the headers in one writev call, without copying it into the
+port's buffer."
+  (cond
+   ((bytevector? body)
+    (force-output client)
+    (call-with-values open-bytevector-output-port
+      (lambda (port get-bytevector)
+        (set-port-encoding! port (port-encoding client))
+        (write-response response port)
+        (fd-writev-all client (list (get-bytevector) body)))))
+   (else
+    (write-response response client)
+    (when body
+      (if (response-content-length response)
+          (body client)
+          (let ((chunked-port
+                 (make-chunked-output-port client
+                                           #:keep-alive? #t)))
+            (body chunked-port)
+            (close-port chunked-port))))
+    (force-output client))))
+
 (define (keep-alive? response)
   (let ((v (response-version response)))
     (and (or (< (response-code response) 400)
@@ -171,63 +211,129 @@ on the procedure being called at any particular time."
               ((0) (memq 'keep-alive (response-connection response)))))
            (else #f)))))
 
-(define (client-loop client handler)
+(define (client-loop client handler buffer-size request-timeout)
+  ;; Bound the time that a client may take to send each request,
+  ;; counting from when we start waiting for it, so that slow or idle
+  ;; clients don't tie up connections forever.
+  (define (set-request-deadline! timeout)
+    (set-port-read-deadline!
+     client
+     (and timeout
+          (+ (scheduler-now)
+             (inexact->exact
+              (round (* timeout internal-time-units-per-second)))))))
   ;; Always disable Nagle's algorithm, as we handle buffering
   ;; ourselves; when we force-output, we really want the data to go
   ;; out.
-  (setvbuf client 'block 1024)
+  (setvbuf client 'block buffer-size)
   (setsockopt client IPPROTO_TCP TCP_NODELAY 1)
   (with-throw-handler #t
     (lambda ()
-      (let loop ()
-        (cond
-         ((catch #t
-            (lambda () (eof-object? (lookahead-u8 client)))
-            (lambda _ #t))
-          (close-port client))
-         (else
-          (call-with-values
-              (lambda ()
-                (catch #t
+      (catch 'port-timeout
+        (lambda ()
+          (let loop ()
+            (set-request-deadline! request-timeout)
+            (cond
+             ((catch #t
+                (lambda () (eof-object? (lookahead-u8 client)))
+                (lambda _ #t))
+              (close-port client))
+             (else
+              (call-with-values
                   (lambda ()
-                    (let* ((request (read-request client))
-                           (body (read-request-body request)))
-                      (values request body)))
-                  (lambda (key . args)
-                    (display "While reading request:\n" (current-error-port))
-                    (print-exception (current-error-port) #f key args)
-                    (values #f #f))))
-            (lambda (request body)
-              (call-with-values (lambda ()
-                                  (handle-request handler request body))
-                (lambda (response body)
-                  (write-response response client)
-                  (when body
-                    (if (procedure? body)
-                        (if (response-content-length response)
-                            (body client)
-                            (let ((chunked-port
-                                   (make-chunked-output-port client
-                                                             #:keep-alive? #t)))
-                              (body chunked-port)
-                              (close-port chunked-port)))
-                        (put-bytevector client body)))
-                  (force-output client)
-                  (if (keep-alive? response)
-                      (loop)
-                      (close-port client))))))))))
+                    (catch #t
+                      (lambda ()
+                        (let* ((request (read-request client))
+                               (body (read-request-body request)))
+                          (values request body)))
+                      (lambda (key . args)
+                        (when (eq? key 'port-timeout)
+                          (apply throw key args))
+                        (display "While reading request:\n"
+                                 (current-error-port))
+                        (print-exception (current-error-port) #f key args)
+                        (values #f #f))))
+                (lambda (request body)
+                  (when request-timeout
+                    (set-request-deadline! #f))
+                  (call-with-values (lambda ()
+                                      (handle-request handler request body))
+                    (lambda (response body)
+                      (write-response/body response body client)
+                      (if (keep-alive? response)
+                          (loop)
+                          (close-port client))))))))))
+        (lambda _
+          (close-port client))))
     (lambda (k . args)
       (close-port client))))
 
-(define (socket-loop socket handler)
+(define (return-to-scheduler! sched)
+  ;; Idle peers may steal a runnable fiber; move it back to SCHED.
+  (unless (eq? (current-scheduler) sched)
+    ((suspend-current-task
+      (lambda (current k)
+        (schedule-task sched (lambda () (k values))))))))
+
+(define* (socket-loop socket handler #:key (parallel? #t) home
+                      (buffer-size 1024) (request-timeout #f))
+  ;; 'accept' only suspends when no connection is pending, and spawning
+  ;; a fiber doesn't yield, so each wakeup drains the whole backlog.
+  ;; If HOME is a scheduler, accept and serve clients on it only.
   (let loop ()
     (match (accept socket (logior SOCK_NONBLOCK SOCK_CLOEXEC))
       ((client . sockaddr)
+       (when home
+         (return-to-scheduler! home))
        (spawn-fiber (lambda ()
-                      (client-loop client handler))
-                    #:parallel? #t)
+                      (client-loop client handler buffer-size
+                                   request-timeout))
+                    #:parallel? parallel?)
        (loop)))))
 
+(define (start-listening! socket)
+  ;; We use a large backlog by default.  If the server is suddenly hit
+  ;; with a number of connections on a small backlog, clients won't
+  ;; receive confirmation for their SYN, leading them to retry --
+  ;; probably successfully, but with a large latency.  The listening
+  ;; socket is only ever accepted on, so it doesn't need a port buffer.
+  (listen socket 1024)
+  (set-nonblocking! socket))
+
+(define (spawn-socket-loops socket handler reuse-port?
+                            buffer-size request-timeout)
+  "Spawn the fibers that accept connections on SOCKET.  If REUSE-PORT?,
+open another SO_REUSEPORT listener on the address of SOCKET for each
+peer of the current scheduler, and accept on each listener from its
+own scheduler, serving its clients there too.  Return the list of
+extra listeners, which the caller should close."
+  (cond
+   (reuse-port?
+    (let ((sockaddr (getsockname socket))
+          (sched (current-scheduler)))
+      (spawn-fiber (lambda ()
+                     (socket-loop socket handler #:parallel? #f #:home sched
+                                  #:buffer-size buffer-size
+                                  #:request-timeout request-timeout)))
+      (map (lambda (peer)
+             (let ((socket (make-reuse-port-socket sockaddr)))
+               (start-listening! socket)
+               (spawn-fiber (lambda ()
+                              (socket-loop socket handler
+                                           #:parallel? #f #:home peer
+                                           #:buffer-size buffer-size
+                                           #:request-timeout
+                                           request-timeout))
+                            peer)
+               socket))
+           (scheduler-remote-peers sched))))
+   (else
+    (spawn-fiber (lambda ()
+                   (socket-loop socket handler
+                                #:buffer-size buffer-size
+                                #:request-timeout request-timeout)))
+    '())))
+
 (define (call-with-sigint thunk cvar)
   (let ((handler #f))
     (dynamic-wind
@@ -249,7 +355,11 @@ on the procedure being called at any particular time."
                                (inet-pton family host)
                                INADDR_LOOPBACK))
                      (port 8080)
-                     (socket (make-default-socket family addr port)))
+                     (reuse-port? #f)
+                     (buffer-size 1024)
+                     (request-timeout #f)
+                     (socket (make-default-socket family addr port
+                                                  #:reuse-port? reuse-port?)))
   "Run the fibers web server.
 
 HANDLER should be a procedure that takes two arguments, the HTTP request
@@ -266,19 +376,37 @@ For example, here is a simple \"Hello, World!\" server:
 @end example
 
 The response and body will be run through ‘sanitize-response’
-before sending back to the client."
-  ;; We use a large backlog by default.  If the server is suddenly hit
-  ;; with a number of connections on a small backlog, clients won't
-  ;; receive confirmation for their SYN, leading them to retry --
-  ;; probably successfully, but with a large latency.
-  (listen socket 1024)
-  (set-nonblocking! socket)
+before sending back to the client.
+
+If REUSE-PORT? is true, each scheduler gets its own listening socket,
+bound to the same address with SO_REUSEPORT, so that the kernel spreads
+incoming connections over the schedulers.  A SOCKET passed explicitly
+must then have been created with SO_REUSEPORT as well; the other
+listeners are bound to its address, and closed when the server
+returns.
+
+BUFFER-SIZE is the size in bytes of the read and write buffers of
+each client connection.
+
+If REQUEST-TIMEOUT is a number, a client that takes longer than that
+many seconds to send a request, including waiting for the next request
+on a kept-alive connection, is disconnected."
+  (start-listening! socket)
   (sigaction SIGPIPE SIG_IGN)
-  (let ((finished? (make-condition)))
+  (let ((finished? (make-condition))
+        (listeners '()))
     (call-with-sigint
      (lambda ()
-       (run-fibers
-        (lambda ()
-          (spawn-fiber (lambda () (socket-loop socket handler)))
-          (wait finished?))))
+       (dynamic-wind
+         (lambda () #t)
+         (lambda ()
+           (run-fibers
+            (lambda ()
+              (set! listeners
+                (spawn-socket-loops socket handler reuse-port?
+                                    buffer-size request-timeout))
+              (wait finished?))))
+         (lambda ()
+           (for-each close-port listeners)
+           (set! listeners '()))))
      finished?)))
@@ -19,9 +19,15 @@
 ;;;;
 
 (define-module (tests basic)
+  #:use-module (ice-9 ftw)
+  #:use-module (ice-9 match)
+  #:use-module (ice-9 rdelim)
+  #:use-module ((srfi srfi-1) #:select (count))
   #:use-module (fibers)
   #:use-module (fibers conditions)
+  #:use-module (fibers operations)
   #:use-module (fibers scheduler)
+  #:use-module (fibers timers)
   #:use-module ((system foreign) #:select (sizeof)))
 
 (define failed? #f)
@@ -298,6 +304,23 @@
               (iota count)))
   (assert-run-fibers-terminates (test-wakeup-order 10) #:parallelism 1 #:drain? #t))
 
+;; Fibers spawned with later deadlines first should still run earliest
+;; deadline first on a deadline-ordered scheduler.
+(let ((run-order 0))
+  (define (test-deadline-order count)
+    (let ((now (scheduler-now)))
+      (for-each (lambda (n)
+                  (spawn-fiber
+                   (lambda ()
+                     (unless (eqv? run-order (- count n 1))
+                       (error "bad deadline order" run-order n))
+                     (set! run-order (1+ run-order)))
+                   #:deadline (+ now (- count n))))
+                (iota count))))
+  (assert-run-fibers-terminates (test-deadline-order 10)
+                                #:parallelism 1 #:deadline-ordered? #t
+                                #:drain? #t))
+
 (assert-run-fibers-returns (1) 1)
 
 (define (check-sleep timeout)
@@ -314,6 +337,159 @@
 (assert-run-fibers-terminates
  (do-times 20 (check-sleep (random 1.0))) #:drain? #t)
 
+;; Timers fire by the scheduler clock, which is read once per turn: a
+;; timer whose expiry is based on scheduler-now never fires before the
+;; scheduler clock reaches it.
+(define (check-timer/scheduler-clock timeout)
+  (spawn-fiber (lambda ()
+                 (let* ((start (scheduler-now))
+                        (expiry (+ start
+                                   (inexact->exact
+                                    (round (* timeout
+                                              internal-time-units-per-second))))))
+                   (perform-operation (timer-operation expiry))
+                   (when (< (scheduler-now) expiry)
+                     (format #t "timer fired at ~a before expiry ~a\n"
+                             (scheduler-now) expiry)
+                     (set! failed? #t))))))
+
+(assert-run-fibers-terminates
+ (do-times 20 (check-timer/scheduler-clock (random 0.1))) #:drain? #t)
+
+;; Timers with slack may fire late, but never early, and many of them
+;; should be able to share the same wakeup.  With a slack of 0.1s, the
+;; expiries are rounded up to multiples of 2^26ns, about 67ms, so 1000
+;; sleeps of up to a second wake up on at most 18 distinct turns of a
+;; single scheduler.  Without coalescing, nearly every one of them would
+;; get its own turn.
+(define (check-sleep/slack count max-timeout slack)
+  (let ((early 0)
+        (wakeups (make-hash-table)))
+    (run-fibers
+     (lambda ()
+       (do-times count
+                 (spawn-fiber
+                  (lambda ()
+                    (let ((timeout (random max-timeout))
+                          (start (get-internal-real-time)))
+                      (perform-operation (sleep-operation timeout
+                                                          #:slack slack))
+                      (when (< (/ (- (get-internal-real-time) start)
+                                  1.0 internal-time-units-per-second)
+                               timeout)
+                        (set! early (1+ early)))
+                      (hashv-set! wakeups (scheduler-now) #t))))))
+     #:parallelism 1 #:drain? #t)
+    (list early (hash-count (const #t) wakeups))))
+
+(assert-equal '(0 #t)
+              (match (check-sleep/slack 1000 1.0 0.1)
+                ((early wakeups) (list early (<= wakeups 18)))))
+
+;; Waiting on a port past its read deadline raises 'port-timeout'; data
+;; that arrives before the deadline is read as usual.
+(define (call-with-nonblocking-pipe proc)
+  (let* ((ports (pipe))
+         (in (car ports))
+         (out (cdr ports)))
+    (fcntl in F_SETFL (logior O_NONBLOCK (fcntl in F_GETFL)))
+    (call-with-values (lambda () (proc in out))
+      (lambda vals
+        (close-port in)
+        (close-port out)
+        (apply values vals)))))
+
+(define (seconds-from-now seconds)
+  (+ (scheduler-now)
+     (inexact->exact (round (* seconds internal-time-units-per-second)))))
+
+(assert-run-fibers-returns (port-timeout)
+                           (call-with-nonblocking-pipe
+                            (lambda (in out)
+                              (set-port-read-deadline! in (seconds-from-now 0.05))
+                              (catch 'port-timeout
+                                (lambda () (read-char in))
+                                (lambda (key . args) key)))))
+
+(assert-run-fibers-returns (#\x)
+                           (call-with-nonblocking-pipe
+                            (lambda (in out)
+                              (set-port-read-deadline! in (seconds-from-now 0.5))
+                              (spawn-fiber (lambda ()
+                                             (sleep 0.01)
+                                             (write-char #\x out)
+                                             (force-output out)))
+                              (read-char in))))
+
+;; Once the port is ready, its deadline's timer no longer counts as
+;; pending work, so draining doesn't wait for it.
+(assert-equal #t
+              (let ((start (get-internal-real-time)))
+                (run-fibers
+                 (lambda ()
+                   (call-with-nonblocking-pipe
+                    (lambda (in out)
+                      (set-port-read-deadline! in (seconds-from-now 10))
+                      (spawn-fiber (lambda ()
+                                     (sleep 0.01)
+                                     (write-char #\x out)
+                                     (force-output out)))
+                      (read-char in))))
+                 #:drain? #t)
+                (< (- (get-internal-real-time) start)
+                   (* 5 internal-time-units-per-second))))
+
+;; Waiting on the same fd from fibers on different schedulers, one after
+;; the other, moves its registration along: while a fiber waits on the
+;; fd, no other scheduler's epoll set still holds it.
+(define (epoll-sets-watching fd)
+  (define (epoll? name)
+    (equal? (false-if-exception (readlink (string-append "/proc/self/fd/"
+                                                         name)))
+            "anon_inode:[eventpoll]"))
+  (define (watches-fd? name)
+    (call-with-input-file (string-append "/proc/self/fdinfo/" name)
+      (lambda (port)
+        (let lp ()
+          (match (read-line port)
+            ((? eof-object?) #f)
+            (line
+             (match (string-tokenize line)
+               (("tfd:" tfd . _)
+                (or (eqv? (string->number tfd) fd) (lp)))
+               (_ (lp)))))))))
+  (count (lambda (name)
+           (and (epoll? name) (watches-fd? name)))
+         (scandir "/proc/self/fd"
+                  (lambda (name) (string->number name)))))
+
+(define (check-fd-moves)
+  (assert-run-fibers-returns (#t)
+                             (call-with-nonblocking-pipe
+                              (lambda (in out)
+                                (let lp ((i 0) (ok? #t))
+                                  (cond
+                                   ((= i 20) ok?)
+                                   (else
+                                    (let ((done (make-condition)))
+                                      (spawn-fiber (lambda ()
+                                                     (read-char in)
+                                                     (signal-condition! done))
+                                                   #:parallel? #t)
+                                      ;; Let the fiber block, and the
+                                      ;; previous owner release the fd.
+                                      (sleep 0.02)
+                                      (let ((n (epoll-sets-watching
+                                                (fileno in))))
+                                        (write-char #\x out)
+                                        (force-output out)
+                                        (wait done)
+                                        (lp (1+ i) (and ok? (<= n 1))))))))))
+                             #:parallelism 2))
+
+(when (file-exists? "/proc/self/fdinfo")
+  (check-fd-moves))
+
 ;; exceptions
 
 ;; closing port causes pollerr
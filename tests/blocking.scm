@@ -0,0 +1,108 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests blocking)
+  #:use-module (fibers)
+  #:use-module (fibers blocking)
+  #:use-module (fibers channels)
+  #:use-module (fibers operations)
+  #:use-module (fibers timers)
+  #:use-module ((ice-9 threads) #:select (current-thread)))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(define-syntax-rule (assert-run-fibers-terminates exp)
+  (begin
+    (format #t "assert run-fibers on ~s terminates: " 'exp)
+    (force-output)
+    (let ((start (get-internal-real-time)))
+      (call-with-values (lambda () (run-fibers (lambda () exp)))
+        (lambda vals
+          (format #t "ok (~a s)\n" (/ (- (get-internal-real-time) start)
+                                      1.0 internal-time-units-per-second))
+          (apply values vals))))))
+
+(define-syntax-rule (assert-run-fibers-returns (expected ...) exp)
+  (begin
+    (call-with-values (lambda () (assert-run-fibers-terminates exp))
+      (lambda run-fiber-return-vals
+        (assert-equal '(expected ...) run-fiber-return-vals)))))
+
+(assert-run-fibers-returns (1 2) (call-blocking (lambda () (values 1 2))))
+
+;; The thunk runs on some other kernel thread.
+(assert-run-fibers-returns (#f)
+                           (let ((thread (current-thread)))
+                             (eq? thread (call-blocking current-thread))))
+
+;; Exceptions are re-raised in the fiber.
+(assert-run-fibers-returns (oops)
+                           (catch 'oops
+                             (lambda ()
+                               (call-blocking (lambda () (throw 'oops))))
+                             (lambda (key . args) key)))
+
+;; Other fibers keep running while a blocking call is in progress.
+(assert-run-fibers-returns (fiber)
+                           (let ((ch (make-channel)))
+                             (spawn-fiber
+                              (lambda ()
+                                (call-blocking (lambda () ((@ (guile) sleep) 1)))
+                                (put-message ch 'blocking)))
+                             (spawn-fiber
+                              (lambda () (put-message ch 'fiber)))
+                             (get-message ch)))
+
+;; Blocking operations compose with timeouts.
+(assert-run-fibers-returns (timeout)
+                           (perform-operation
+                            (choice-operation
+                             (blocking-operation
+                              (lambda () ((@ (guile) sleep) 1) 'done))
+                             (wrap-operation (sleep-operation 0.05)
+                                             (lambda () 'timeout)))))
+
+;; More calls than worker threads.
+(assert-run-fibers-returns (4950)
+                           (let ((pool (make-blocking-pool #:size 2))
+                                 (ch (make-channel)))
+                             (for-each (lambda (n)
+                                         (spawn-fiber
+                                          (lambda ()
+                                            (put-message
+                                             ch
+                                             (call-blocking (lambda () n)
+                                                            pool)))))
+                                       (iota 100))
+                             (let lp ((i 0) (sum 0))
+                               (if (< i 100)
+                                   (lp (1+ i) (+ sum (get-message ch)))
+                                   sum))))
+
+(exit (if failed? 1 0))
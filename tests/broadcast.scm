@@ -0,0 +1,142 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests broadcast)
+  #:use-module (fibers)
+  #:use-module (fibers broadcast)
+  #:use-module (fibers conditions)
+  #:use-module (fibers operations)
+  #:use-module (fibers timers))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(define-syntax-rule (assert-run-fibers-terminates exp kw ...)
+  (begin
+    (format #t "assert run-fibers on ~s terminates: " 'exp)
+    (force-output)
+    (let ((start (get-internal-real-time)))
+      (call-with-values (lambda () (run-fibers (lambda () exp) kw ...))
+        (lambda vals
+          (format #t "ok (~a s)\n" (/ (- (get-internal-real-time) start)
+                                      1.0 internal-time-units-per-second))
+          (apply values vals))))))
+
+(define-syntax-rule (assert-run-fibers-returns (expected ...) exp kw ...)
+  (begin
+    (call-with-values (lambda () (assert-run-fibers-terminates exp kw ...))
+      (lambda run-fiber-return-vals
+        (assert-equal '(expected ...) run-fiber-return-vals)))))
+
+(define (get/timeout sub)
+  (perform-operation
+   (choice-operation (subscription-get-operation sub)
+                     (wrap-operation (sleep-operation 0.05)
+                                     (lambda () 'timeout)))))
+
+;; Every subscriber sees every message, in order.
+(assert-run-fibers-returns ((0 1 2 3 4 5 6 7 8 9))
+                           (let* ((bc (make-broadcast #:capacity 4
+                                                      #:policy 'block))
+                                  (wg (make-wait-group 10))
+                                  (results (make-vector 10 #f)))
+                             (for-each
+                              (lambda (i)
+                                (let ((sub (subscribe bc)))
+                                  (spawn-fiber
+                                   (lambda ()
+                                     (let lp ((msgs '()))
+                                       (if (= (length msgs) 10)
+                                           (vector-set! results i
+                                                        (reverse msgs))
+                                           (lp (cons (subscription-get sub)
+                                                     msgs))))
+                                     (unsubscribe! sub)
+                                     (wait-group-done! wg))
+                                   #:parallel? #t)))
+                              (iota 10))
+                             (for-each (lambda (i) (publish! bc i)) (iota 10))
+                             (wait-group-wait wg)
+                             (let ((expected (vector-ref results 0)))
+                               (and (and-map (lambda (r)
+                                               (equal? r expected))
+                                             (vector->list results))
+                                    expected))))
+
+;; A subscriber only sees messages published after it subscribed, and
+;; waits for the next one.
+(assert-run-fibers-returns (b timeout)
+                           (let ((bc (make-broadcast)))
+                             (publish! bc 'a)
+                             (let ((sub (subscribe bc)))
+                               (publish! bc 'b)
+                               (values (get/timeout sub) (get/timeout sub)))))
+
+;; With 'drop, a slow subscriber skips to the oldest kept message.
+(assert-run-fibers-returns (6 7 timeout)
+                           (let* ((bc (make-broadcast #:capacity 2))
+                                  (sub (subscribe bc)))
+                             (for-each (lambda (i) (publish! bc i)) (iota 8))
+                             (values (get/timeout sub) (get/timeout sub)
+                                     (get/timeout sub))))
+
+;; With 'lag-error, it gets an error first.
+(assert-run-fibers-returns ((broadcast-lagged 6) 6)
+                           (let* ((bc (make-broadcast #:capacity 2
+                                                      #:policy 'lag-error))
+                                  (sub (subscribe bc)))
+                             (for-each (lambda (i) (publish! bc i)) (iota 8))
+                             (let ((err (catch 'broadcast-lagged
+                                          (lambda () (get/timeout sub))
+                                          (lambda (key who fmt args data)
+                                            (cons key data)))))
+                               (values err (get/timeout sub)))))
+
+;; With 'block, the publisher waits for the slowest subscriber.
+(assert-run-fibers-returns (#t 0 #t)
+                           (let* ((bc (make-broadcast #:capacity 2
+                                                      #:policy 'block))
+                                  (sub (subscribe bc))
+                                  (published (make-condition)))
+                             (define (published?)
+                               (perform-operation
+                                (choice-operation
+                                 (wrap-operation (wait-operation published)
+                                                 (lambda () #t))
+                                 (wrap-operation (sleep-operation 0.05)
+                                                 (lambda () #f)))))
+                             (spawn-fiber
+                              (lambda ()
+                                (for-each (lambda (i) (publish! bc i))
+                                          (iota 3))
+                                (signal-condition! published)))
+                             (let* ((blocked? (not (published?)))
+                                    (first (subscription-get sub)))
+                               (values blocked? first (published?)))))
+
+(exit (if failed? 1 0))
@@ -19,7 +19,8 @@
 (define-module (tests channels)
   #:use-module ((ice-9 threads) #:select (current-processor-count))
   #:use-module (fibers)
-  #:use-module (fibers channels))
+  #:use-module (fibers channels)
+  #:use-module (fibers operations))
 
 (define failed? #f)
 
@@ -93,6 +94,76 @@
 
 (assert-run-fibers-terminates (pingpong (current-processor-count) 1000))
 
+(assert-equal #t (let ((ch (make-channel)))
+                   (eq? (get-operation ch) (get-operation ch))))
+
+(define (sum-with-reused-operation N)
+  (let* ((ch (make-channel))
+         (op (get-operation ch)))
+    (spawn-fiber (lambda ()
+                   (let lp ((n 0))
+                     (when (< n N)
+                       (put-message ch n)
+                       (lp (1+ n)))))
+                 #:parallel? #t)
+    (let lp ((n 0) (sum 0))
+      (if (< n N)
+          (lp (1+ n) (+ sum (perform-operation op)))
+          sum))))
+
+(assert-run-fibers-returns (499500) (sum-with-reused-operation 1000))
+
+;; Batches hold the messages of senders that are already waiting, up
+;; to the limit.
+(assert-run-fibers-returns ((3 2 1) (0 1 2 3 4 5))
+                           (let ((ch (make-channel)))
+                             (for-each (lambda (n)
+                                         (spawn-fiber
+                                          (lambda () (put-message ch n))))
+                                       (iota 6))
+                             ;; Let all the senders block.
+                             (sleep 0.01)
+                             (let* ((a (get-batch ch 3))
+                                    (b (get-batch ch 2))
+                                    (c (get-batch ch 10)))
+                               (values (map length (list a b c))
+                                       (sort (append a b c) <)))))
+
+(define (sum-batches N)
+  (let ((ch (make-channel)))
+    (spawn-fiber (lambda ()
+                   (let lp ((n 0))
+                     (when (< n N)
+                       (put-message ch n)
+                       (lp (1+ n)))))
+                 #:parallel? #t)
+    (let lp ((n 0) (sum 0))
+      (if (< n N)
+          (let ((batch (get-batch ch 16)))
+            (lp (+ n (length batch)) (apply + sum batch)))
+          sum))))
+
+(assert-run-fibers-returns (499500) (sum-batches 1000))
+
+;; Polling an operation doesn't block, and doesn't leave the operation
+;; behind for senders to complete.
+(assert-run-fibers-returns (#f none 42 #f)
+                           (let ((ch (make-channel)))
+                             (let* ((a (try-perform-operation (get-operation ch)))
+                                    (b (try-perform-operation
+                                        (get-operation ch)
+                                        (lambda () 'none))))
+                               (spawn-fiber (lambda () (put-message ch 42)))
+                               ;; Let the sender block.
+                               (sleep 0.01)
+                               (let* ((c (try-perform-operation
+                                          (choice-operation
+                                           (get-operation (make-channel))
+                                           (get-operation ch))))
+                                      (d (try-perform-operation
+                                          (put-operation ch 'lost))))
+                                 (values a b c d)))))
+
 ;; timed channel wait
 
 ;; multi-channel wait
@@ -22,6 +22,8 @@
   #:use-module (ice-9 threads)
   #:use-module (ice-9 rdelim)
   #:use-module (ice-9 binary-ports)
+  #:use-module (ice-9 textual-ports)
+  #:use-module (ice-9 ftw)
   #:use-module (rnrs bytevectors)
   #:use-module (web uri)
   #:use-module (web http)
@@ -59,6 +61,11 @@
                  (content-length . ,(bytevector-length bv)))
                (lambda (port)
                  (put-bytevector port bv)))))
+    ("/big"
+     ;; Too big to fit in the socket buffers, so that writing it has to
+     ;; wait for the client.
+     (values '((content-type . (application/octet-stream)))
+             (make-bytevector (* 16 1024 1024) 0)))
     ("/proc-chunked"
      (values `((content-type   . (application/octet-stream)))
              (lambda (port)
@@ -98,4 +105,33 @@
       (assert-equal 10000
                     (length data)))))
 
+;; A client that disconnects while the server waits to write the
+;; response doesn't leave the connection's fiber and fd hanging.
+(define (open-fd-count)
+  (length (scandir "/proc/self/fd")))
+
+(define (wait-for-fd-count n)
+  (let lp ((tries 100))
+    (cond
+     ((<= (open-fd-count) n) #t)
+     ((zero? tries) #f)
+     (else
+      (usleep 10000)
+      (lp (1- tries))))))
+
+(when (file-exists? "/proc/self/fd")
+  ;; Let the server close the connections of the previous requests.
+  (usleep 100000)
+  (let* ((baseline (open-fd-count))
+         (client (socket PF_INET SOCK_STREAM 0)))
+    (connect client AF_INET INADDR_LOOPBACK port)
+    (put-string client "GET /big HTTP/1.1\r\nHost: localhost\r\n\r\n")
+    (force-output client)
+    ;; Let the server fill the socket buffers and start waiting.
+    (usleep 100000)
+    ;; Closing with a zero linger time resets the connection.
+    (setsockopt client SOL_SOCKET SO_LINGER (cons 1 0))
+    (close-port client)
+    (assert-equal #t (wait-for-fd-count baseline))))
+
 (exit (if failed? 1 0))
@@ -22,7 +22,8 @@
   #:use-module (fibers conditions)
   #:use-module (fibers operations)
   #:use-module (fibers scheduler)
-  #:use-module (fibers timers))
+  #:use-module (fibers timers)
+  #:use-module (ice-9 atomic))
 
 (define failed? #f)
 
@@ -79,6 +80,73 @@
                              (wait cv)
                              #t))
 
+;; Wait groups.
+(define (wait-group-wait/timeout wg)
+  (perform-operation
+   (with-timeout
+    (wrap-operation (wait-group-wait-operation wg)
+                    (lambda () #t))
+    #:wrap (lambda () #f))))
+
+(let ((wg (make-wait-group)))
+  (assert-equal #t (wait-group? wg))
+  (assert-run-fibers-returns (#t) (wait-group-wait/timeout wg))
+  (wait-group-add! wg 2)
+  (assert-run-fibers-returns (#f) (wait-group-wait/timeout wg))
+  (wait-group-done! wg)
+  (assert-run-fibers-returns (#f) (wait-group-wait/timeout wg))
+  (wait-group-done! wg)
+  (assert-run-fibers-returns (#t) (wait-group-wait/timeout wg)))
+(assert-run-fibers-returns (100)
+                           (let ((wg (make-wait-group 100))
+                                 (done (make-atomic-box 0)))
+                             (for-each
+                              (lambda (i)
+                                (spawn-fiber
+                                 (lambda ()
+                                   (let lp ((n (atomic-box-ref done)))
+                                     (let ((n* (atomic-box-compare-and-swap!
+                                                done n (1+ n))))
+                                       (unless (eqv? n n*)
+                                         (lp n*))))
+                                   (wait-group-done! wg))
+                                 #:parallel? #t))
+                              (iota 100))
+                             (wait-group-wait wg)
+                             (atomic-box-ref done)))
+
+;; Resettable events.
+(define (event-wait/timeout ev)
+  (perform-operation
+   (with-timeout
+    (wrap-operation (event-wait-operation ev)
+                    (lambda () #t))
+    #:wrap (lambda () #f))))
+
+(let ((ev (make-event)))
+  (assert-equal #t (event? ev))
+  (assert-equal #f (event-set? ev))
+  (assert-run-fibers-returns (#f) (event-wait/timeout ev))
+  (assert-equal #t (set-event! ev))
+  (assert-equal #f (set-event! ev))
+  (assert-run-fibers-returns (#t) (event-wait/timeout ev))
+  (assert-run-fibers-returns (#t) (event-wait/timeout ev))
+  (assert-equal #t (reset-event! ev))
+  (assert-equal #f (reset-event! ev))
+  (assert-run-fibers-returns (#f) (event-wait/timeout ev)))
+;; A waiter sees a set even if the event is reset again before the
+;; waiter gets to run.
+(assert-run-fibers-returns (#t)
+                           (let ((ev (make-event))
+                                 (woken (make-condition)))
+                             (spawn-fiber (lambda ()
+                                            (event-wait ev)
+                                            (signal-condition! woken)))
+                             (sleep 0.001)
+                             (set-event! ev)
+                             (reset-event! ev)
+                             (wait/timeout woken)))
+
 ;; Make a condition, wait for it inside a fiber, let the fiber abruptly
 ;; terminate and signal the condition afterwards.  This tests for the bug
 ;; noticed at <https://github.com/wingo/fibers/issues/61>.
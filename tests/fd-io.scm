@@ -0,0 +1,323 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests fd-io)
+  #:use-module (rnrs bytevectors)
+  #:use-module (ice-9 binary-ports)
+  #:use-module (ice-9 match)
+  #:use-module (fibers)
+  #:use-module (fibers fd-io)
+  #:use-module (fibers operations)
+  #:use-module (fibers timers))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(define-syntax-rule (assert-run-fibers-terminates exp)
+  (begin
+    (format #t "assert run-fibers on ~s terminates: " 'exp)
+    (force-output)
+    (let ((start (get-internal-real-time)))
+      (call-with-values (lambda () (run-fibers (lambda () exp)))
+        (lambda vals
+          (format #t "ok (~a s)\n" (/ (- (get-internal-real-time) start)
+                                      1.0 internal-time-units-per-second))
+          (apply values vals))))))
+
+(define-syntax-rule (assert-run-fibers-returns (expected ...) exp)
+  (begin
+    (call-with-values (lambda () (assert-run-fibers-terminates exp))
+      (lambda run-fiber-return-vals
+        (assert-equal '(expected ...) run-fiber-return-vals)))))
+
+(define (set-nonblocking! port)
+  (let ((flags (fcntl port F_GETFL)))
+    (fcntl port F_SETFL (logior O_NONBLOCK flags))))
+
+(define-syntax-rule (with-pipes (A B) exp exp* ...)
+  (let* ((pipes (pipe))
+	 (A (car pipes))
+	 (B (cdr pipes)))
+    (set-nonblocking! A)
+    (set-nonblocking! B)
+    (call-with-values (lambda () exp exp* ...)
+      (lambda vals
+        (close A)
+        (close B)
+        (apply values vals)))))
+
+;; Reading from an empty pipe waits for the writer.
+(assert-equal
+ #vu8(1 2 3)
+ (with-pipes (A B)
+   (run-fibers
+    (lambda ()
+      (spawn-fiber (lambda ()
+                     (sleep 0.05)
+                     (fd-write B #vu8(1 2 3))))
+      (let* ((bv (make-bytevector 10 0))
+             (n (fd-read! A bv 2)))
+        (let ((out (make-bytevector n)))
+          (bytevector-copy! bv 2 out 0 n)
+          out))))))
+
+;; Reads time out like any other operation.
+(assert-equal
+ 'timeout
+ (with-pipes (A B)
+   (run-fibers
+    (lambda ()
+      (perform-operation
+       (choice-operation
+        (fd-read-operation A (make-bytevector 10))
+        (wrap-operation (sleep-operation 0.05) (lambda () 'timeout))))))))
+
+;; Writes to a full pipe wait for the reader to drain it.
+(define (transfer-through-pipe total)
+  (with-pipes (A B)
+    (run-fibers
+     (lambda ()
+       (spawn-fiber (lambda ()
+                      (let ((bv (make-bytevector total 42)))
+                        (let lp ((start 0))
+                          (when (< start total)
+                            (lp (+ start (fd-write B bv start))))))
+                      (close-port B)))
+       (let ((bv (make-bytevector 4096)))
+         (let lp ((received 0))
+           (let ((n (fd-read! A bv)))
+             (if (zero? n)
+                 received
+                 (lp (+ received n))))))))))
+
+(assert-equal (* 1024 1024) (transfer-through-pipe (* 1024 1024)))
+
+;; Vectored writes and reads, with slices of all shapes.
+(assert-equal
+ '(8 #vu8(1 2 3 4 5 6 7 8))
+ (with-pipes (A B)
+   (run-fibers
+    (lambda ()
+      (fd-writev-all B (list #vu8(1 2) '(#vu8(0 3 4 5 0) 1 3) #vu8()
+                             '(#vu8(6 7 8) 0 3)))
+      (let* ((head (make-bytevector 3))
+             (tail (make-bytevector 10))
+             (n (fd-readv! A (list head (list tail 0 5)))))
+        (let ((out (make-bytevector n)))
+          (bytevector-copy! head 0 out 0 3)
+          (bytevector-copy! tail 0 out 3 (- n 3))
+          (list n out)))))))
+
+;; More slices than one writev call takes, and more bytes than fit in
+;; the pipe.
+(define (writev-through-pipe slice-count slice-size)
+  (with-pipes (A B)
+    (run-fibers
+     (lambda ()
+       (spawn-fiber (lambda ()
+                      (fd-writev-all B (map (lambda (_)
+                                              (make-bytevector slice-size 42))
+                                            (iota slice-count)))
+                      (close-port B)))
+       (let ((bv (make-bytevector 4096)))
+         (let lp ((received 0))
+           (let ((n (fd-read! A bv)))
+             (if (zero? n)
+                 received
+                 (lp (+ received n))))))))))
+
+(assert-equal (* 1000 1000) (writev-through-pipe 1000 1000))
+
+;; sendfile and splice move data from a file to a socket.
+(define (call-with-temporary-file size proc)
+  (let* ((port (mkstemp (string-copy "/tmp/fibers-fd-io-XXXXXX")))
+         (file (port-filename port)))
+    (put-bytevector port (make-bytevector size 42))
+    (force-output port)
+    (seek port 0 SEEK_SET)
+    (call-with-values (lambda () (proc port))
+      (lambda vals
+        (close-port port)
+        (delete-file file)
+        (apply values vals)))))
+
+(define (receive-all port)
+  (let ((bv (make-bytevector 4096)))
+    (let lp ((received 0))
+      (let ((n (fd-read! port bv)))
+        (if (zero? n)
+            received
+            (lp (+ received n)))))))
+
+(define (transfer-file-through-socket size send)
+  (call-with-temporary-file
+   size
+   (lambda (file)
+     (match (socketpair AF_UNIX SOCK_STREAM 0)
+       ((a . b)
+        (set-nonblocking! a)
+        (set-nonblocking! b)
+        (run-fibers
+         (lambda ()
+           (spawn-fiber (lambda ()
+                          (send b file size)
+                          (close-port b)))
+           (let ((received (receive-all a)))
+             (close-port a)
+             received))))))))
+
+(when (string=? (utsname:sysname (uname)) "Linux")
+  (assert-equal (* 1024 1024)
+                (transfer-file-through-socket
+                 (* 1024 1024)
+                 (lambda (out in size) (sendfile-all out in size 0))))
+  (assert-equal (* 1024 1024)
+                (transfer-file-through-socket
+                 (* 1024 1024)
+                 (lambda (out in size) (splice-all in out)))))
+
+;; Datagrams in batches.
+(define (transfer-datagrams count)
+  (match (socketpair AF_UNIX SOCK_DGRAM 0)
+    ((a . b)
+     (set-nonblocking! a)
+     (set-nonblocking! b)
+     (run-fibers
+      (lambda ()
+        (spawn-fiber
+         (lambda ()
+           (let ((batch (make-datagram-batch 10 16)))
+             (let lp ((i 0))
+               (when (< i count)
+                 (let ((n (min 10 (- count i))))
+                   (for-each (lambda (j)
+                               (datagram-batch-set!
+                                batch j (make-bytevector (1+ (modulo (+ i j) 16))
+                                                         (modulo (+ i j) 256))))
+                             (iota n))
+                   (set-datagram-batch-count! batch n)
+                   (send-datagrams b batch)
+                   (lp (+ i n))))))))
+        (let ((batch (make-datagram-batch 32 16)))
+          (let lp ((i 0) (ok? #t))
+            (if (< i count)
+                (let ((n (recv-datagrams! a batch)))
+                  (lp (+ i n)
+                      (and ok?
+                           (= n (datagram-batch-count batch))
+                           (let check ((j 0))
+                             (or (= j n)
+                                 (and (equal? (datagram-batch-ref batch j)
+                                              (make-bytevector
+                                               (1+ (modulo (+ i j) 16))
+                                               (modulo (+ i j) 256)))
+                                      (check (1+ j))))))))
+                (begin
+                  (close-port a)
+                  (close-port b)
+                  ok?)))))))))
+
+(assert-equal #t (transfer-datagrams 1000))
+
+;; Datagrams longer than the slot size are truncated, and reported as
+;; such.
+(define (receive-truncated)
+  (match (socketpair AF_UNIX SOCK_DGRAM 0)
+    ((a . b)
+     (set-nonblocking! a)
+     (set-nonblocking! b)
+     (run-fibers
+      (lambda ()
+        (let ((out (make-datagram-batch 2 32))
+              (in (make-datagram-batch 2 16)))
+          (datagram-batch-set! out 0 (make-bytevector 32 1))
+          (datagram-batch-set! out 1 (make-bytevector 8 2))
+          (set-datagram-batch-count! out 2)
+          (send-datagrams b out)
+          (let lp ((received '()))
+            (if (< (length received) 2)
+                (let ((n (recv-datagrams! a in)))
+                  (lp (append received
+                              (map (lambda (i)
+                                     (list (datagram-batch-length in i)
+                                           (datagram-batch-truncated? in i)))
+                                   (iota n)))))
+                (begin
+                  (close-port a)
+                  (close-port b)
+                  received)))))))))
+
+(assert-equal '((16 #t) (8 #f)) (receive-truncated))
+
+;; An error on the fd while a fiber waits, here a connection reset by
+;; the peer, is raised in the waiting fiber instead of being lost in
+;; the scheduler.
+(define (reset-while-waiting)
+  (let ((listener (socket PF_INET SOCK_STREAM 0))
+        (client (socket PF_INET SOCK_STREAM 0)))
+    (bind listener AF_INET INADDR_LOOPBACK 0)
+    (listen listener 1)
+    (connect client (getsockname listener))
+    (let ((server (car (accept listener))))
+      (set-nonblocking! server)
+      (run-fibers
+       (lambda ()
+         (spawn-fiber
+          (lambda ()
+            (sleep 0.01)
+            ;; Closing with a zero linger time resets the connection.
+            (setsockopt client SOL_SOCKET SO_LINGER (cons 1 0))
+            (close-port client)))
+         (let ((result
+                (catch 'system-error
+                  (lambda ()
+                    (perform-operation
+                     (choice-operation
+                      (fd-recv-operation server (make-bytevector 16))
+                      (wrap-operation (sleep-operation 10)
+                                      (lambda () 'timeout)))))
+                  (lambda args
+                    (system-error-errno args)))))
+           (close-port server)
+           (close-port listener)
+           result))))))
+
+(assert-equal ECONNRESET (reset-while-waiting))
+
+;; Out-of-range arguments are rejected.
+(assert-equal #t
+              (with-pipes (A B)
+                (catch 'out-of-range
+                  (lambda () (fd-write B #vu8(1) 0 2))
+                  (lambda _ #t))))
+
+(exit (if failed? 1 0))
+
+;; Local Variables:
+;; eval: (put 'with-pipes 'scheme-indent-function 1)
+;; End:
@@ -67,4 +67,24 @@
 (assert-equal 42 (receive-from-fiber 42))
 (assert-equal 42 (send-to-fiber 42))
 
+;; Many blocking operations in a row from the same foreign thread, which
+;; reuse the same parker.
+(define (receive-many-from-fiber n)
+  (let* ((ch (make-channel))
+         (t (call-with-new-thread
+             (lambda ()
+               (run-fibers (lambda ()
+                             (let lp ((i 0))
+                               (when (< i n)
+                                 (put-message ch i)
+                                 (lp (1+ i))))))))))
+    (let lp ((i 0) (sum 0))
+      (if (< i n)
+          (lp (1+ i) (+ sum (get-message ch)))
+          (begin
+            (join-thread t)
+            sum)))))
+
+(assert-equal 499500 (receive-many-from-fiber 1000))
+
 (exit (if failed? 1 0))
@@ -20,9 +20,13 @@
 (define-module (tests io-wakeup)
   #:use-module (rnrs bytevectors)
   #:use-module (ice-9 control)
+  #:use-module (ice-9 match)
   #:use-module (ice-9 suspendable-ports)
   #:use-module (ice-9 binary-ports)
   #:use-module (fibers)
+  #:use-module (fibers channels)
+  #:use-module (fibers events-impl)
+  #:use-module (fibers io-primitives)
   #:use-module (fibers io-wakeup)
   #:use-module (fibers operations)
   #:use-module (fibers timers))
@@ -192,6 +196,106 @@
     (close-port t1))
   (close-port s))
 
+;; File descriptors at or above FD_SETSIZE (1024) work too.  Raise the
+;; soft limit on open files if we can; otherwise skip this test.
+(define (raise-fd-limit! n)
+  (call-with-values (lambda () (getrlimit 'nofile))
+    (lambda (soft hard)
+      (or (not soft)
+          (>= soft n)
+          (and (or (not hard) (>= hard n))
+               (false-if-exception (setrlimit 'nofile n hard))
+               #t)))))
+
+(when (raise-fd-limit! 2048)
+  (with-pipes (A B)
+    (let ((A* (fdopen (dup->fdes (fileno A) 1100) "r"))
+          (B* (fdopen (dup->fdes (fileno B) 1101) "w")))
+      (setvbuf A* 'none)
+      (setvbuf B* 'none)
+      (assert-equal #f (primitive-fd-readable? (fileno A*)))
+      (assert-equal #t (primitive-fd-writable? (fileno B*)))
+      (assert-run-fibers-returns (#t) (readable/timeout? A*))
+      (assert-run-fibers-returns (#f) (writable/timeout? B*))
+      ;; A fiber waiting for the high fd is woken when it becomes
+      ;; readable.
+      (assert-run-fibers-returns (42)
+                                 (let ((ch (make-channel)))
+                                   (spawn-fiber
+                                    (lambda ()
+                                      (perform-operation
+                                       (wait-until-port-readable-operation A*))
+                                      (put-message ch (get-u8 A*))))
+                                   (sleep 0.01)
+                                   (put-u8 B* 42)
+                                   (get-message ch)))
+      (assert-equal #f (primitive-fd-readable? (fileno A*)))
+      (close-port A*)
+      (close-port B*))))
+
+;; Exclusive registrations are accepted by the events backend, even
+;; replacing a spent one-shot registration, and removing an fd twice is
+;; harmless.
+(unless (zero? EVENTS_IMPL_EXCLUSIVE)
+  (let ((impl (events-impl-create))
+        (s (socket PF_INET SOCK_STREAM 0)))
+    (bind s AF_INET INADDR_LOOPBACK 0)
+    (listen s 1)
+    (assert-equal #t
+                  (begin
+                    (events-impl-add! impl (fileno s) EVENTS_IMPL_READ)
+                    (events-impl-add! impl (fileno s)
+                                      (logior EVENTS_IMPL_READ
+                                              EVENTS_IMPL_EXCLUSIVE))
+                    (events-impl-remove! impl (fileno s))
+                    (events-impl-remove! impl (fileno s))
+                    (events-impl-add! impl (fileno s)
+                                      (logior EVENTS_IMPL_READ
+                                              EVENTS_IMPL_EXCLUSIVE))
+                    #t))
+    (events-impl-destroy impl)
+    (close-port s)))
+
+;; Fibers on several schedulers accepting exclusively on the same socket
+;; still get all of the connections between them.
+(let ((s (socket PF_INET SOCK_STREAM 0))
+      (count 8))
+  (bind s AF_INET INADDR_LOOPBACK 0)
+  (listen s count)
+  (set-nonblocking! s)
+  (assert-run-fibers-returns (8)
+                             (let ((ch (make-channel)))
+                               (for-each
+                                (lambda (i)
+                                  (spawn-fiber
+                                   (lambda ()
+                                     (let lp ()
+                                       (match (perform-operation
+                                               (accept-operation
+                                                s #:exclusive? #t))
+                                         ((client . addr)
+                                          (close-port client)
+                                          (put-message ch 'accepted)
+                                          (lp)))))
+                                   #:parallel? #t))
+                                (iota 4))
+                               (let ((clients (map (lambda (i)
+                                                     (let ((c (socket PF_INET
+                                                                      SOCK_STREAM
+                                                                      0)))
+                                                       (connect c (getsockname s))
+                                                       c))
+                                                   (iota count))))
+                                 (let lp ((n 0))
+                                   (if (< n count)
+                                       (begin
+                                         (get-message ch)
+                                         (lp (1+ n)))
+                                       (begin
+                                         (for-each close-port clients)
+                                         n))))))
+  (close-port s))
+
 (exit (if failed? 1 0))
 
 ;; Local Variables:
@@ -0,0 +1,141 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests mutex)
+  #:use-module (fibers)
+  #:use-module (fibers mutex)
+  #:use-module (fibers operations)
+  #:use-module (fibers timers)
+  #:use-module ((ice-9 threads)
+                #:select (call-with-new-thread join-thread)))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(define-syntax-rule (assert-run-fibers-terminates exp kw ...)
+  (begin
+    (format #t "assert run-fibers on ~s terminates: " 'exp)
+    (force-output)
+    (let ((start (get-internal-real-time)))
+      (call-with-values (lambda () (run-fibers (lambda () exp) kw ...))
+        (lambda vals
+          (format #t "ok (~a s)\n" (/ (- (get-internal-real-time) start)
+                                      1.0 internal-time-units-per-second))
+          (apply values vals))))))
+
+(define-syntax-rule (assert-run-fibers-returns (expected ...) exp kw ...)
+  (begin
+    (call-with-values (lambda () (assert-run-fibers-terminates exp kw ...))
+      (lambda run-fiber-return-vals
+        (assert-equal '(expected ...) run-fiber-return-vals)))))
+
+(let ((m (make-mutex)))
+  (assert-equal #t (mutex? m))
+  (assert-equal #t (try-lock-mutex m))
+  (assert-equal #f (try-lock-mutex m))
+  (unlock-mutex m)
+  (assert-equal #t (try-lock-mutex m))
+  (unlock-mutex m))
+
+;; Fibers that yield while holding the mutex still exclude each other.
+(define (count-with-mutex fibers iterations)
+  (let ((m (make-mutex))
+        (inside? #f)
+        (count 0))
+    (define (fiber)
+      (let lp ((i 0))
+        (when (< i iterations)
+          (with-mutex m
+            (when inside?
+              (error "two fibers inside the mutex"))
+            (set! inside? #t)
+            (let ((c count))
+              (sleep 0)
+              (set! count (1+ c)))
+            (set! inside? #f))
+          (lp (1+ i)))))
+    (let ((finished (map (lambda (i)
+                           (let ((m (make-mutex)))
+                             (lock-mutex m)
+                             (spawn-fiber (lambda ()
+                                            (fiber)
+                                            (unlock-mutex m))
+                                          #:parallel? #t)
+                             m))
+                         (iota fibers))))
+      (for-each lock-mutex finished)
+      count)))
+
+(assert-run-fibers-returns (1000) (count-with-mutex 10 100))
+
+;; Waiters get the mutex in FIFO order.
+(assert-run-fibers-returns ((0 1 2 3 4))
+                           (let ((m (make-mutex))
+                                 (order '()))
+                             (lock-mutex m)
+                             (for-each
+                              (lambda (i)
+                                (spawn-fiber (lambda ()
+                                               (with-mutex m
+                                                 (set! order (cons i order)))))
+                                ;; Let the fiber start waiting.
+                                (sleep 0.001))
+                              (iota 5))
+                             (unlock-mutex m)
+                             (sleep 0.01)
+                             (reverse order))
+                           #:parallelism 1)
+
+;; Locking can time out, and a timed-out waiter doesn't keep the mutex
+;; from the next one.
+(assert-run-fibers-returns (timeout #t)
+                           (let ((m (make-mutex)))
+                             (lock-mutex m)
+                             (let ((result
+                                    (perform-operation
+                                     (choice-operation
+                                      (wrap-operation (lock-operation m)
+                                                      (lambda () 'locked))
+                                      (wrap-operation (sleep-operation 0.01)
+                                                      (lambda () 'timeout))))))
+                               (unlock-mutex m)
+                               (values result (try-lock-mutex m)))))
+
+;; Threads that aren't running fibers can use the mutex too.
+(let ((m (make-mutex))
+      (count 0))
+  (define (work)
+    (let lp ((i 0))
+      (when (< i 1000)
+        (with-mutex m (set! count (1+ count)))
+        (lp (1+ i)))))
+  (let ((threads (map (lambda (i) (call-with-new-thread work)) (iota 4))))
+    (for-each join-thread threads)
+    (assert-equal 4000 count)))
+
+(exit (if failed? 1 0))
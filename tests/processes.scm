@@ -0,0 +1,113 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests processes)
+  #:use-module (ice-9 rdelim)
+  #:use-module (ice-9 ftw)
+  #:use-module (fibers)
+  #:use-module (fibers channels)
+  #:use-module (fibers processes))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(define-syntax-rule (assert-run-fibers-terminates exp)
+  (begin
+    (format #t "assert run-fibers on ~s terminates: " 'exp)
+    (force-output)
+    (let ((start (get-internal-real-time)))
+      (call-with-values (lambda () (run-fibers (lambda () exp)))
+        (lambda vals
+          (format #t "ok (~a s)\n" (/ (- (get-internal-real-time) start)
+                                      1.0 internal-time-units-per-second))
+          (apply values vals))))))
+
+(define-syntax-rule (assert-run-fibers-returns (expected ...) exp)
+  (begin
+    (call-with-values (lambda () (assert-run-fibers-terminates exp))
+      (lambda run-fiber-return-vals
+        (assert-equal '(expected ...) run-fiber-return-vals)))))
+
+;; spawn-process needs Guile's 'spawn'.
+(unless (defined? 'spawn)
+  (exit 77))
+
+(assert-run-fibers-returns ("hello" 3)
+                           (let ((process (spawn-process
+                                           "sh" '("sh" "-c" "echo hello; exit 3")
+                                           #:output 'pipe)))
+                             (let ((line (read-line (process-output process))))
+                               (close-port (process-output process))
+                               (values line
+                                       (status:exit-val
+                                        (wait-for-process process))))))
+
+;; Many children can be waited for at once, and several fibers can wait
+;; for the same child.
+(assert-run-fibers-returns (40)
+                           (let ((ch (make-channel))
+                                 (processes
+                                  (map (lambda (i)
+                                         (spawn-process "true" '("true")))
+                                       (iota 20))))
+                             (for-each
+                              (lambda (process)
+                                (for-each
+                                 (lambda (i)
+                                   (spawn-fiber
+                                    (lambda ()
+                                      (put-message
+                                       ch (status:exit-val
+                                           (wait-for-process process))))))
+                                 '(1 2)))
+                              processes)
+                             (let lp ((n 0) (count 0))
+                               (if (= n 40)
+                                   count
+                                   (lp (1+ n)
+                                       (+ count (if (zero? (get-message ch))
+                                                    1 0)))))))
+
+;; Reaping a child closes its pidfd right away, and waiting for it
+;; again still returns its status.
+(define (open-fd-count)
+  (length (scandir "/proc/self/fd")))
+
+(when (file-exists? "/proc/self/fd")
+  (assert-run-fibers-returns (#t (5 5))
+                             (let* ((before (open-fd-count))
+                                    (process (spawn-process
+                                              "sh" '("sh" "-c" "exit 5")))
+                                    (status (wait-for-process process)))
+                               (values (= before (open-fd-count))
+                                       (map status:exit-val
+                                            (list status
+                                                  (wait-for-process
+                                                   process)))))))
+
+(exit (if failed? 1 0))
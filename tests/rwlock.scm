@@ -0,0 +1,148 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests rwlock)
+  #:use-module (fibers)
+  #:use-module (fibers rwlock)
+  #:use-module (fibers conditions)
+  #:use-module ((ice-9 threads)
+                #:select (call-with-new-thread join-thread)))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(define-syntax-rule (assert-run-fibers-terminates exp kw ...)
+  (begin
+    (format #t "assert run-fibers on ~s terminates: " 'exp)
+    (force-output)
+    (let ((start (get-internal-real-time)))
+      (call-with-values (lambda () (run-fibers (lambda () exp) kw ...))
+        (lambda vals
+          (format #t "ok (~a s)\n" (/ (- (get-internal-real-time) start)
+                                      1.0 internal-time-units-per-second))
+          (apply values vals))))))
+
+(define-syntax-rule (assert-run-fibers-returns (expected ...) exp kw ...)
+  (begin
+    (call-with-values (lambda () (assert-run-fibers-terminates exp kw ...))
+      (lambda run-fiber-return-vals
+        (assert-equal '(expected ...) run-fiber-return-vals)))))
+
+(let ((l (make-rwlock)))
+  (assert-equal #t (rwlock? l))
+  (read-lock! l)
+  (read-lock! l)
+  (read-unlock! l)
+  (read-unlock! l)
+  (write-lock! l)
+  (write-unlock! l)
+  (assert-equal 42 (with-read-lock l 42))
+  (assert-equal 42 (with-write-lock l 42)))
+
+;; Readers hold the lock together; writers hold it alone, even when
+;; they yield while holding it.
+(define (check-exclusion readers writers iterations)
+  (let ((l (make-rwlock))
+        (reading 0)
+        (writing 0)
+        (most-readers 0)
+        (violations 0)
+        (writes 0))
+    (define (reader)
+      (let lp ((i 0))
+        (when (< i iterations)
+          (with-read-lock l
+            (unless (zero? writing)
+              (set! violations (1+ violations)))
+            (set! reading (1+ reading))
+            (set! most-readers (max most-readers reading))
+            (sleep 0)
+            (set! reading (1- reading)))
+          (lp (1+ i)))))
+    (define (writer)
+      (let lp ((i 0))
+        (when (< i iterations)
+          (with-write-lock l
+            (unless (and (zero? writing) (zero? reading))
+              (set! violations (1+ violations)))
+            (set! writing (1+ writing))
+            (let ((w writes))
+              (sleep 0)
+              (set! writes (1+ w)))
+            (set! writing (1- writing)))
+          (lp (1+ i)))))
+    (let ((done (make-condition))
+          (remaining (+ readers writers)))
+      (define (spawn thunk)
+        (spawn-fiber (lambda ()
+                       (thunk)
+                       (set! remaining (1- remaining))
+                       (when (zero? remaining)
+                         (signal-condition! done)))))
+      (for-each (lambda (i) (spawn reader)) (iota readers))
+      (for-each (lambda (i) (spawn writer)) (iota writers))
+      (wait done)
+      (values violations writes (> most-readers 1)))))
+
+(assert-run-fibers-returns (0 300 #t) (check-exclusion 10 3 100)
+                           #:parallelism 1)
+
+;; A pending writer keeps new readers out.
+(assert-run-fibers-returns ((write read))
+                           (let ((l (make-rwlock))
+                                 (order '()))
+                             (read-lock! l)
+                             (spawn-fiber
+                              (lambda ()
+                                (with-write-lock l
+                                  (set! order (cons 'write order)))))
+                             (sleep 0.001)
+                             (spawn-fiber
+                              (lambda ()
+                                (with-read-lock l
+                                  (set! order (cons 'read order)))))
+                             (sleep 0.001)
+                             (read-unlock! l)
+                             (sleep 0.01)
+                             (reverse order)))
+
+;; Readers and writers on several kernel threads.
+(let ((l (make-rwlock))
+      (count 0))
+  (define (work)
+    (let lp ((i 0))
+      (when (< i 1000)
+        (if (zero? (modulo i 10))
+            (with-write-lock l (set! count (1+ count)))
+            (with-read-lock l count))
+        (lp (1+ i)))))
+  (let ((threads (map (lambda (i) (call-with-new-thread work)) (iota 4))))
+    (for-each join-thread threads)
+    (assert-equal 400 count)))
+
+(exit (if failed? 1 0))
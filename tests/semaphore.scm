@@ -0,0 +1,148 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests semaphore)
+  #:use-module (fibers)
+  #:use-module (fibers semaphore)
+  #:use-module (fibers operations)
+  #:use-module (fibers timers)
+  #:use-module (ice-9 atomic)
+  #:use-module ((ice-9 threads)
+                #:select (call-with-new-thread join-thread)))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(define-syntax-rule (assert-run-fibers-terminates exp kw ...)
+  (begin
+    (format #t "assert run-fibers on ~s terminates: " 'exp)
+    (force-output)
+    (let ((start (get-internal-real-time)))
+      (call-with-values (lambda () (run-fibers (lambda () exp) kw ...))
+        (lambda vals
+          (format #t "ok (~a s)\n" (/ (- (get-internal-real-time) start)
+                                      1.0 internal-time-units-per-second))
+          (apply values vals))))))
+
+(define-syntax-rule (assert-run-fibers-returns (expected ...) exp kw ...)
+  (begin
+    (call-with-values (lambda () (assert-run-fibers-terminates exp kw ...))
+      (lambda run-fiber-return-vals
+        (assert-equal '(expected ...) run-fiber-return-vals)))))
+
+(let ((sem (make-semaphore 3)))
+  (assert-equal #t (semaphore? sem))
+  (assert-equal #t (try-acquire! sem 2))
+  (assert-equal 1 (semaphore-permits sem))
+  (assert-equal #f (try-acquire! sem 2))
+  (assert-equal #t (try-acquire! sem))
+  (assert-equal #f (try-acquire! sem))
+  (release! sem 3)
+  (assert-equal 3 (semaphore-permits sem)))
+
+;; No more than N fibers hold a permit at the same time.
+(define (max-concurrency permits fibers iterations)
+  (let ((sem (make-semaphore permits))
+        (inside (make-atomic-box 0))
+        (most (make-atomic-box 0)))
+    (define (update! box f)
+      (let lp ((x (atomic-box-ref box)))
+        (let ((prev (atomic-box-compare-and-swap! box x (f x))))
+          (unless (eqv? prev x)
+            (lp prev)))))
+    (define (fiber)
+      (let lp ((i 0))
+        (when (< i iterations)
+          (call-with-semaphore sem
+            (lambda ()
+              (update! inside 1+)
+              (update! most (lambda (n) (max n (atomic-box-ref inside))))
+              (sleep 0)
+              (update! inside 1-)))
+          (lp (1+ i)))))
+    (let ((done (make-semaphore 0)))
+      (for-each (lambda (i)
+                  (spawn-fiber (lambda ()
+                                 (fiber)
+                                 (release! done))
+                               #:parallel? #t))
+                (iota fibers))
+      (acquire! done fibers)
+      (values (<= (atomic-box-ref most) permits)
+              (semaphore-permits sem)))))
+
+(assert-run-fibers-returns (#t 3) (max-concurrency 3 10 100))
+
+;; Waiters are served in FIFO order, and a waiter for many permits is
+;; not overtaken by later waiters for fewer.
+(assert-run-fibers-returns (() (0 1 2 3 4))
+                           (let ((sem (make-semaphore 0))
+                                 (order '()))
+                             (for-each
+                              (lambda (i)
+                                (spawn-fiber
+                                 (lambda ()
+                                   (acquire! sem (if (= i 0) 3 1))
+                                   (set! order (cons i order))))
+                                ;; Let the fiber start waiting.
+                                (sleep 0.001))
+                              (iota 5))
+                             (release! sem 2)
+                             (sleep 0.01)
+                             (let ((early order))
+                               (release! sem 5)
+                               (sleep 0.01)
+                               (values early (reverse order))))
+                           #:parallelism 1)
+
+;; Acquiring can time out, and a timed-out waiter doesn't hold up the
+;; waiters behind it.
+(assert-run-fibers-returns (timeout #t)
+                           (let ((sem (make-semaphore 1)))
+                             (let ((result
+                                    (perform-operation
+                                     (choice-operation
+                                      (wrap-operation (acquire-operation sem 2)
+                                                      (lambda () 'acquired))
+                                      (wrap-operation (sleep-operation 0.01)
+                                                      (lambda () 'timeout))))))
+                               (values result (try-acquire! sem)))))
+
+;; Threads that aren't running fibers can use semaphores too.
+(let ((sem (make-semaphore 1))
+      (count 0))
+  (define (work)
+    (let lp ((i 0))
+      (when (< i 1000)
+        (call-with-semaphore sem (lambda () (set! count (1+ count))))
+        (lp (1+ i)))))
+  (let ((threads (map (lambda (i) (call-with-new-thread work)) (iota 4))))
+    (for-each join-thread threads)
+    (assert-equal 4000 count)))
+
+(exit (if failed? 1 0))
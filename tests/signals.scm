@@ -0,0 +1,77 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests signals)
+  #:use-module (fibers)
+  #:use-module (fibers operations)
+  #:use-module (fibers signals)
+  #:use-module (fibers timers))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(define-syntax-rule (assert-run-fibers-terminates exp)
+  (begin
+    (format #t "assert run-fibers on ~s terminates: " 'exp)
+    (force-output)
+    (let ((start (get-internal-real-time)))
+      (call-with-values (lambda () (run-fibers (lambda () exp)))
+        (lambda vals
+          (format #t "ok (~a s)\n" (/ (- (get-internal-real-time) start)
+                                      1.0 internal-time-units-per-second))
+          (apply values vals))))))
+
+(define-syntax-rule (assert-run-fibers-returns (expected ...) exp)
+  (begin
+    (call-with-values (lambda () (assert-run-fibers-terminates exp))
+      (lambda run-fiber-return-vals
+        (assert-equal '(expected ...) run-fiber-return-vals)))))
+
+;; A fiber waiting for a signal wakes up when it arrives.
+(assert-run-fibers-returns (#t)
+                           (begin
+                             (spawn-fiber (lambda ()
+                                            (sleep 0.01)
+                                            (kill (getpid) SIGUSR1)))
+                             (eqv? SIGUSR1 (wait-for-signal SIGUSR1))))
+
+;; A signal that arrives while no one waits is not lost.
+(assert-run-fibers-returns (#t)
+                           (let ((op (signal-operation SIGUSR2)))
+                             (kill (getpid) SIGUSR2)
+                             (eqv? SIGUSR2 (perform-operation op))))
+
+;; Waiting for a signal composes with other operations.
+(assert-run-fibers-returns (timeout)
+                           (perform-operation
+                            (choice-operation
+                             (signal-operation SIGUSR1)
+                             (wrap-operation (sleep-operation 0.01)
+                                             (lambda () 'timeout)))))
+
+(exit (if failed? 1 0))
@@ -70,4 +70,30 @@
   (timer-wheel-advance! wheel (timer-wheel-next-tick-end wheel) check!)
   (unless (= count event-count) (error "what4" count event-count)))
 
+(define (remove-test)
+  (define start (get-internal-real-time))
+  (define wheel (make-timer-wheel #:now start))
+  (define (seconds n) (+ start (* n internal-time-units-per-second)))
+  (define fired '())
+  (define (fire! obj) (set! fired (cons obj fired)))
+
+  (define near (timer-wheel-add! wheel (seconds 1) 'near))
+  (define far (timer-wheel-add! wheel (seconds 60) 'far))
+  (timer-wheel-add! wheel (seconds 2) 'kept)
+
+  ;; Removing the next entry to fire, from any wheel, updates the next
+  ;; entry time.
+  (timer-wheel-remove! wheel near)
+  (unless (= (timer-wheel-next-entry-time wheel) (seconds 2))
+    (error "removed entry still next" (timer-wheel-next-entry-time wheel)))
+  (timer-wheel-remove! wheel far)
+  (timer-wheel-advance! wheel (seconds 120) fire!)
+  (unless (equal? fired '(kept)) (error "removed entries fired" fired))
+  ;; Removing an entry again, or after it fired, does nothing.
+  (timer-wheel-remove! wheel near)
+  (timer-wheel-remove! wheel far)
+  (when (timer-wheel-next-entry-time wheel)
+    (error "wheel not empty" (timer-wheel-next-entry-time wheel))))
+
 (self-test)
+(remove-test)
@@ -0,0 +1,100 @@
+;; Fibers: cooperative, event-driven user-space threads.
+
+;;;; Copyright (C) 2023 Free Software Foundation, Inc.
+;;;;
+;;;; This library is free software; you can redistribute it and/or
+;;;; modify it under the terms of the GNU Lesser General Public
+;;;; License as published by the Free Software Foundation; either
+;;;; version 3 of the License, or (at your option) any later version.
+;;;;
+;;;; This library is distributed in the hope that it will be useful,
+;;;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;;;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;;;; Lesser General Public License for more details.
+;;;;
+;;;; You should have received a copy of the GNU Lesser General Public License
+;;;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;;;;
+
+(define-module (tests web-server-reuse-port)
+  #:use-module (ice-9 threads)
+  #:use-module (web uri)
+  #:use-module (web client)
+  #:use-module (web response)
+  #:use-module (fibers web server))
+
+(define failed? #f)
+
+(define-syntax-rule (assert-equal expected actual)
+  (let ((x expected))
+    (format #t "assert ~s equal to ~s: " 'actual x)
+    (force-output)
+    (let ((y actual))
+      (cond
+       ((equal? x y) (format #t "ok\n"))
+       (else
+        (format #t "no (got ~s)\n" y)
+        (set! failed? #t))))))
+
+(unless (defined? 'SO_REUSEPORT)
+  (exit 77))
+
+(define (handler request body)
+  (values '((content-type . (text/plain)))
+          "Hello, World!"))
+
+;; Our own listening socket on a port picked by the kernel, which the
+;; server's other listeners have to share.
+(define sock
+  (let ((sock (socket PF_INET SOCK_STREAM 0)))
+    (setsockopt sock SOL_SOCKET SO_REUSEADDR 1)
+    (setsockopt sock SOL_SOCKET SO_REUSEPORT 1)
+    (bind sock AF_INET INADDR_LOOPBACK 0)
+    sock))
+
+(define sockaddr (getsockname sock))
+
+(define server
+  (call-with-new-thread
+   (lambda ()
+     (run-server handler #:socket sock #:reuse-port? #t)
+     'done)))
+
+(define (get)
+  (catch 'system-error
+    (lambda ()
+      (call-with-values
+          (lambda ()
+            (http-get (build-uri 'http #:host "127.0.0.1"
+                                 #:port (sockaddr:port sockaddr))))
+        (lambda (response body)
+          (response-code response))))
+    (lambda _ #f)))
+
+;; Wait for the server to start listening.
+(let lp ((tries 100))
+  (unless (or (zero? tries) (get))
+    (usleep 10000)
+    (lp (1- tries))))
+
+(assert-equal (make-list 50 200)
+              (map (lambda (i) (get)) (iota 50)))
+
+;; Stopping the server closes the listeners it opened; once ours is
+;; closed too, nothing listens on the port anymore.
+(kill (getpid) SIGINT)
+(assert-equal 'done (join-thread server))
+(close-port sock)
+(assert-equal #t
+              (let ((sock (socket PF_INET SOCK_STREAM 0)))
+                (setsockopt sock SOL_SOCKET SO_REUSEADDR 1)
+                (catch 'system-error
+                  (lambda ()
+                    (bind sock sockaddr)
+                    (close-port sock)
+                    #t)
+                  (lambda _
+                    (close-port sock)
+                    #f))))
+
+(exit (if failed? 1 0))